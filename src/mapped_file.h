@@ -0,0 +1,125 @@
+#pragma once
+
+// Read-only memory mapping of a whole file, shared by the readers that use their files in place
+
+#include <string>
+#include <filesystem>
+#include <cstdint>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+private:
+    const uint8_t* view = nullptr;
+    uint64_t bytes = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int file = -1;
+#endif
+    
+    bool Map(const std::string& path) {
+#ifdef _WIN32
+        // Recordings are mapped while the recorder may still be appending to them
+        file = CreateFileW(std::filesystem::path(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                           OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+            return false;
+        }
+        bytes = static_cast<uint64_t>(size.QuadPart);
+        mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping == nullptr) {
+            return false;
+        }
+        view = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        return view != nullptr;
+#else
+        file = open(path.c_str(), O_RDONLY);
+        if (file < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(file, &info) != 0 || info.st_size == 0) {
+            return false;
+        }
+        bytes = static_cast<uint64_t>(info.st_size);
+        void* address = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, file, 0);
+        if (address == MAP_FAILED) {
+            return false;
+        }
+        view = static_cast<const uint8_t*>(address);
+        return true;
+#endif
+    }
+    
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    ~MappedFile() {
+        Close();
+    }
+    
+    // Maps the file; false if it cannot be opened, is empty or cannot be mapped
+    bool Open(const std::string& path) {
+        Close();
+        if (!Map(path)) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+    
+    void Close() {
+#ifdef _WIN32
+        if (view) {
+            UnmapViewOfFile(view);
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (view) {
+            munmap(const_cast<uint8_t*>(view), bytes);
+        }
+        if (file >= 0) {
+            close(file);
+        }
+        file = -1;
+#endif
+        view = nullptr;
+        bytes = 0;
+    }
+    
+    const uint8_t* Data() const {
+        return view;
+    }
+    
+    uint64_t Size() const {
+        return bytes;
+    }
+};
@@ -7,533 +7,3030 @@
 #include <fstream>
 #include <iomanip>
 #include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <cmath>
+#include <sstream>
+#include <memory>
+#include <list>
+#include <atomic>
 
-#include "c-api/c-api.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+#endif
 
-struct SpeakerSegment {
-    float start;
-    float end;
-    int speaker;
-    std::string text;
+#include "transcription_engine.h"
+#include "transcript_file.h"
+
+// The daemon's socket lives in a directory only its user can write to: the user's own temp
+// directory on Windows, $XDG_RUNTIME_DIR or else a private directory under /tmp elsewhere
+std::string DefaultSocketPath() {
+#ifdef _WIN32
+    return (std::filesystem::temp_directory_path() / "transcribe.sock").string();
+#else
+    const char* runtimeDirectory = std::getenv("XDG_RUNTIME_DIR");
+    if (runtimeDirectory && *runtimeDirectory) {
+        return (std::filesystem::path(runtimeDirectory) / "transcribe.sock").string();
+    }
+    return "/tmp/transcribe-" + std::to_string(getuid()) + "/transcribe.sock";
+#endif
+}
+
+// Which files skip diarization and are transcribed as a single speaker (VAD + ASR)
+enum class SingleSpeakerPolicy {
+    Never,
+    Microphone,  // Files named *_microphone*, which record only the local user
+    Always,
+    Auto         // Files whose speaker embeddings barely vary across sampled windows
+};
+
+struct TranscribeOptions {
+    std::vector<std::string> inputFiles;
+    std::string outputDirectory;  // Where the transcript is written; empty means the current directory
+    bool serve = false;
+    bool noDaemon = false;
+    std::string socketPath = DefaultSocketPath();
+    int maxJobs = 2;
+    std::string watchDirectory;           // --watch: transcribe recordings as they appear in this directory
+    bool newestFirst = true;              // Order in which --watch runs queued recordings
+    float watchSettleSeconds = 10.0f;     // How long --watch waits for the second track of a recording
+    std::vector<std::string> modelTiers;  // ASR models the daemon or --watch picks from, best first
+    float targetLatencyMinutes = 0.0f;    // Backlog the tiers are chosen to finish within; 0 = always the best
+    std::string modelTier;                // Tier a job runs with, as written to the transcript header
+    std::string startupJsonPath;
+    std::string statsJsonPath;
+    TranscriptionMode mode = TranscriptionMode::Diarize;
+    SingleSpeakerPolicy singleSpeaker = SingleSpeakerPolicy::Microphone;
+    float singleSpeakerVariance = 0.15f;
+    DecodeSettings decode;
+    DiarizationSettings diarization;
+    SilenceSettings silence;
+    unsigned deferredModels = 0;          // Models to load once a track turns out not to be silent
+    bool clusterSpeakers = true;          // Match speakers across the files of a recording by voice
+    float speakerClusterThreshold = 0.5f;
+    bool saveEmbeddings = false;          // Write an embedding sidecar next to the transcript
+    bool saveBinary = false;              // Also write the transcript in the binary format (.tsb)
+    std::string cacheDirectory;           // Transcript cache; empty disables it
+    int cacheMaxMb = 1024;
+    int prefetchMb = 512;                 // Read-ahead of the next file per recording set; 0 disables it
+    bool journal = true;                  // Journal finished segments so an interrupted run can resume
+    bool warmUp = false;                  // Run each preloaded model once before the first job
+    bool optimizedModelCache = true;      // Load models from optimized copies written next to them
+    std::string reclusterFile;            // Sidecar to re-cluster instead of transcribing
+    std::string convertFile;              // Binary transcript to render instead of transcribing
+    std::string convertFormat = "text";   // What --convert renders it to: text or json
+    float reclusterThreshold = 0.5f;      // Same units as the diarization clustering threshold
+    std::string benchDecodeFile;
+    std::vector<std::string> benchVadFiles;
+};
+
+bool ParseArguments(const std::vector<std::string>& args, TranscribeOptions& options, std::string& error) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        
+        // Flags that take a value
+        auto nextValue = [&](std::string& value) {
+            if (i + 1 >= args.size()) {
+                error = "Missing value for " + arg;
+                return false;
+            }
+            value = args[++i];
+            return true;
+        };
+        
+        std::string value;
+        if (arg == "--serve") {
+            options.serve = true;
+        } else if (arg == "--watch") {
+            if (!nextValue(options.watchDirectory)) return false;
+        } else if (arg == "--priority") {
+            if (!nextValue(value)) return false;
+            if (value == "newest") {
+                options.newestFirst = true;
+            } else if (value == "oldest") {
+                options.newestFirst = false;
+            } else {
+                error = "--priority must be newest or oldest";
+                return false;
+            }
+        } else if (arg == "--watch-settle") {
+            if (!nextValue(value)) return false;
+            options.watchSettleSeconds = std::max(0.0f, static_cast<float>(std::atof(value.c_str())));
+        } else if (arg == "--model-tiers") {
+            if (!nextValue(value)) return false;
+            options.modelTiers.clear();
+            std::stringstream stream(value);
+            std::string tier;
+            while (std::getline(stream, tier, ',')) {
+                if (!tier.empty()) {
+                    options.modelTiers.push_back(tier);
+                }
+            }
+        } else if (arg == "--target-latency") {
+            if (!nextValue(value)) return false;
+            options.targetLatencyMinutes = std::max(0.0f, static_cast<float>(std::atof(value.c_str())));
+        } else if (arg == "--no-daemon") {
+            options.noDaemon = true;
+        } else if (arg == "--socket") {
+            if (!nextValue(options.socketPath)) return false;
+        } else if (arg == "--no-diarize") {
+            options.mode = TranscriptionMode::NoDiarize;
+        } else if (arg == "--vad-only") {
+            options.mode = TranscriptionMode::VadOnly;
+        } else if (arg == "--no-silence-skip") {
+            options.silence.enabled = false;
+        } else if (arg == "--silence-rms-db") {
+            if (!nextValue(value)) return false;
+            options.silence.maxRmsDb = static_cast<float>(std::atof(value.c_str()));
+        } else if (arg == "--silence-peak-db") {
+            if (!nextValue(value)) return false;
+            options.silence.maxPeakDb = static_cast<float>(std::atof(value.c_str()));
+        } else if (arg == "--single-speaker") {
+            if (!nextValue(value)) return false;
+            if (value == "never") {
+                options.singleSpeaker = SingleSpeakerPolicy::Never;
+            } else if (value == "mic") {
+                options.singleSpeaker = SingleSpeakerPolicy::Microphone;
+            } else if (value == "always") {
+                options.singleSpeaker = SingleSpeakerPolicy::Always;
+            } else if (value == "auto") {
+                options.singleSpeaker = SingleSpeakerPolicy::Auto;
+            } else {
+                error = "--single-speaker must be one of never, mic, always, auto";
+                return false;
+            }
+        } else if (arg == "--single-speaker-variance") {
+            if (!nextValue(value)) return false;
+            options.singleSpeakerVariance = static_cast<float>(std::atof(value.c_str()));
+        } else if (arg == "--max-segment") {
+            if (!nextValue(value)) return false;
+            options.decode.maxSegmentSeconds = static_cast<float>(std::atof(value.c_str()));
+        } else if (arg == "--merge-gap") {
+            if (!nextValue(value)) return false;
+            options.decode.mergeGapSeconds = static_cast<float>(std::atof(value.c_str()));
+        } else if (arg == "--cascade") {
+            options.decode.cascade = true;
+        } else if (arg == "--cascade-threshold") {
+            if (!nextValue(value)) return false;
+            options.decode.cascadeThreshold = static_cast<float>(std::atof(value.c_str()));
+        } else if (arg == "--asr-workers") {
+            if (!nextValue(value)) return false;
+            options.decode.workers = std::max(0, std::atoi(value.c_str()));
+        } else if (arg == "--diarize-chunk") {
+            if (!nextValue(value)) return false;
+            options.diarization.chunkSeconds = static_cast<float>(std::atof(value.c_str()));
+        } else if (arg == "--diarize-overlap") {
+            if (!nextValue(value)) return false;
+            options.diarization.chunkOverlapSeconds = static_cast<float>(std::atof(value.c_str()));
+        } else if (arg == "--speaker-link-threshold") {
+            if (!nextValue(value)) return false;
+            options.diarization.linkThreshold = static_cast<float>(std::atof(value.c_str()));
+        } else if (arg == "--speaker-cluster-threshold") {
+            if (!nextValue(value)) return false;
+            options.speakerClusterThreshold = static_cast<float>(std::atof(value.c_str()));
+        } else if (arg == "--no-speaker-clustering") {
+            options.clusterSpeakers = false;
+        } else if (arg == "--cache-dir") {
+            if (!nextValue(options.cacheDirectory)) return false;
+        } else if (arg == "--prefetch-mb") {
+            if (!nextValue(value)) return false;
+            options.prefetchMb = std::max(0, std::atoi(value.c_str()));
+        } else if (arg == "--cache-max-mb") {
+            if (!nextValue(value)) return false;
+            options.cacheMaxMb = std::max(0, std::atoi(value.c_str()));
+        } else if (arg == "--warm-up") {
+            options.warmUp = true;
+        } else if (arg == "--no-model-cache") {
+            options.optimizedModelCache = false;
+        } else if (arg == "--no-journal") {
+            options.journal = false;
+        } else if (arg == "--save-embeddings") {
+            options.saveEmbeddings = true;
+        } else if (arg == "--save-binary") {
+            options.saveBinary = true;
+        } else if (arg == "--convert") {
+            if (!nextValue(options.convertFile)) return false;
+        } else if (arg == "--to") {
+            if (!nextValue(options.convertFormat)) return false;
+            if (options.convertFormat != "text" && options.convertFormat != "json") {
+                error = "--to must be text or json";
+                return false;
+            }
+        } else if (arg == "--recluster") {
+            if (!nextValue(options.reclusterFile)) return false;
+        } else if (arg == "--threshold") {
+            if (!nextValue(value)) return false;
+            options.reclusterThreshold = static_cast<float>(std::atof(value.c_str()));
+        } else if (arg == "--bench-decode") {
+            if (!nextValue(options.benchDecodeFile)) return false;
+        } else if (arg == "--bench-vad") {
+            if (!nextValue(value)) return false;
+            options.benchVadFiles.push_back(value);
+        } else if (arg == "--startup-json") {
+            if (!nextValue(options.startupJsonPath)) return false;
+        } else if (arg == "--stats-json") {
+            if (!nextValue(options.statsJsonPath)) return false;
+        } else if (arg == "--max-jobs") {
+            if (!nextValue(value)) return false;
+            options.maxJobs = std::atoi(value.c_str());
+            if (options.maxJobs <= 0) {
+                error = "--max-jobs must be a positive number";
+                return false;
+            }
+        } else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+            error = "Unknown option: " + arg;
+            return false;
+        } else {
+            options.inputFiles.push_back(arg);
+        }
+    }
+    return true;
+}
+
+void PrintUsage(const char* programName) {
+    std::cout << "Usage: " << programName << " [options] <wav_file1> [wav_file2] ..." << std::endl;
+    std::cout << "       " << programName << " --serve [--socket <path>] [--max-jobs <n>]" << std::endl;
+    std::cout << "       " << programName << " --watch <dir> [--priority newest|oldest] [--max-jobs <n>] [options]" << std::endl;
+    std::cout << "       " << programName << " --recluster <transcript.emb> [--threshold <v>]" << std::endl;
+    std::cout << "       " << programName << " --convert <transcript.tsb> [--to text|json]" << std::endl;
+    std::cout << "Example: " << programName << " recording_20250912_152706_microphone.wav recording_20250912_152706_system.wav" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --serve            Keep the models resident and accept jobs on a local socket" << std::endl;
+    std::cout << "  --socket <path>    Socket used by --serve and by clients (default: " << DefaultSocketPath() << ")" << std::endl;
+    std::cout << "  --max-jobs <n>     Number of jobs the daemon or --watch runs concurrently (default: 2)" << std::endl;
+    std::cout << "  --watch <dir>      Transcribe each recording once it is completely written to <dir>; the job" << std::endl;
+    std::cout << "                     queue is kept in <dir>/.transcribe_queue and survives restarts" << std::endl;
+    std::cout << "  --priority <newest|oldest>" << std::endl;
+    std::cout << "                     Which queued recording --watch transcribes first (default: newest)" << std::endl;
+    std::cout << "  --watch-settle <s> How long --watch waits for the other track of a recording (default: 10)" << std::endl;
+    std::cout << "  --model-tiers <dir,...>" << std::endl;
+    std::cout << "                     ASR models the daemon or --watch chooses from per job, best (slowest) first" << std::endl;
+    std::cout << "  --target-latency <min>" << std::endl;
+    std::cout << "                     Use the best tier expected to finish the backlog within this many minutes" << std::endl;
+    std::cout << "  --no-daemon        Always load the models in this process, even if a daemon is running" << std::endl;
+    std::cout << "  --startup-json <f> Write the model startup timing breakdown as JSON" << std::endl;
+    std::cout << "  --stats-json <f>   Write the per-stage time, CPU and memory breakdown as JSON" << std::endl;
+    std::cout << "  --max-segment <s>  Split speaker turns longer than this many seconds (default: 15, 0 = never)" << std::endl;
+    std::cout << "  --merge-gap <s>    Decode same-speaker turns closer than this as one (default: 0.5, 0 = never)" << std::endl;
+    std::cout << "  --asr-workers <n>  Concurrent decode calls per file (default: one per core)" << std::endl;
+    std::cout << "  --cascade          Decode with the fast model first and re-decode only uncertain segments" << std::endl;
+    std::cout << "  --cascade-threshold <v>" << std::endl;
+    std::cout << "                     Min confidence (0-1) to keep the fast model's text (default: 0.5); for" << std::endl;
+    std::cout << "                     Moonshine models it is estimated from the word rate and repetition" << std::endl;
+    std::cout << "  --diarize-chunk <s>   Diarize long files in chunks of this many seconds (default: 600, 0 = whole file)" << std::endl;
+    std::cout << "  --diarize-overlap <s> Audio shared by neighbouring chunks (default: 15)" << std::endl;
+    std::cout << "  --speaker-link-threshold <v>" << std::endl;
+    std::cout << "                     Min similarity to treat speakers from two chunks as the same (default: 0.5)" << std::endl;
+    std::cout << "  --speaker-cluster-threshold <v>" << std::endl;
+    std::cout << "                     Min similarity to treat speakers from different files as the same (default: 0.5)" << std::endl;
+    std::cout << "  --no-speaker-clustering" << std::endl;
+    std::cout << "                     Keep the speakers of each file apart by ID offsets instead of matching voices" << std::endl;
+    std::cout << "  --cache-dir <dir>  Reuse transcripts of unchanged files from this directory" << std::endl;
+    std::cout << "  --cache-max-mb <n> Size of the transcript cache before old entries are evicted (default: 1024)" << std::endl;
+    std::cout << "  --prefetch-mb <n>  Read up to this much of the next file while the current one is processed (default: 512, 0 = off)" << std::endl;
+    std::cout << "  --no-journal       Do not journal finished segments (by default an interrupted run resumes from them)" << std::endl;
+    std::cout << "  --warm-up          Run each preloaded model once on synthetic audio at startup" << std::endl;
+    std::cout << "  --no-model-cache   Load the original models instead of optimized copies saved next to them" << std::endl;
+    std::cout << "  --save-embeddings  Save segment speaker embeddings next to the transcript (.emb) for --recluster" << std::endl;
+    std::cout << "  --recluster <f>    Reassign speakers from a saved .emb file without running any model" << std::endl;
+    std::cout << "  --save-binary      Also save the transcript in the memory-mappable binary format (.tsb)" << std::endl;
+    std::cout << "  --convert <f>      Render a binary transcript as text (as written by default) or JSON" << std::endl;
+    std::cout << "  --to <format>      Output of --convert: text or json (default: text)" << std::endl;
+    std::cout << "  --threshold <v>    Clustering threshold for --recluster; smaller gives more speakers (default: 0.5)" << std::endl;
+    std::cout << "  --bench-decode <f> Measure decode time against segment length on a WAV file" << std::endl;
+    std::cout << "  --bench-vad <f>    Compare bulk VAD feeding with the per-window loop (repeatable)" << std::endl;
+    std::cout << "  --no-diarize       Transcribe with VAD + ASR only, one speaker per file" << std::endl;
+    std::cout << "  --vad-only         Only detect speech regions, without transcribing them" << std::endl;
+    std::cout << "  --single-speaker <never|mic|always|auto>" << std::endl;
+    std::cout << "                     Files transcribed as one speaker without diarization (default: mic)" << std::endl;
+    std::cout << "  --single-speaker-variance <v>" << std::endl;
+    std::cout << "                     Max embedding variance for --single-speaker auto (default: 0.15)" << std::endl;
+    std::cout << "  --silence-rms-db <v>  Tracks below this RMS level (dBFS) and the peak level are skipped (default: -60)" << std::endl;
+    std::cout << "  --silence-peak-db <v> Peak level (dBFS) a silent track must stay below (default: -40)" << std::endl;
+    std::cout << "  --no-silence-skip  Transcribe every track, even silent ones" << std::endl;
+    std::cout << "The ASR model files should be in: models/sherpa-onnx-moonshine-base-en-int8/" << std::endl;
+    std::cout << "The fast ASR model for --cascade should be in: models/sherpa-onnx-moonshine-tiny-en-int8/" << std::endl;
+    std::cout << "The VAD model file should be: models/silero_vad.int8.onnx" << std::endl;
+    std::cout << "The segmentation model should be: models/sherpa-onnx-pyannote-segmentation-3-0/model.onnx" << std::endl;
+    std::cout << "The embedding model should be: models/nemo_en_titanet_small.onnx" << std::endl;
+}
+
+std::string GenerateTranscriptFilename(const std::string& audioFile) {
+    // Extract the base filename without extension
+    std::filesystem::path path(audioFile);
+    std::string stem = path.stem().string();
+    
+    // Replace "recording" with "transcript" and remove "_microphone" or "_system" suffix
+    std::string transcriptName = stem;
+    
+    // Remove "_microphone" or "_system" suffix if present
+    size_t pos = transcriptName.find("_microphone");
+    if (pos != std::string::npos) {
+        transcriptName = transcriptName.substr(0, pos);
+    } else {
+        pos = transcriptName.find("_system");
+        if (pos != std::string::npos) {
+            transcriptName = transcriptName.substr(0, pos);
+        }
+    }
+    
+    // Replace "recording" with "transcript"
+    pos = transcriptName.find("recording");
+    if (pos != std::string::npos) {
+        transcriptName.replace(pos, 9, "transcript");
+    }
+    
+    return transcriptName + ".txt";
+}
+
+// The text transcript, as written by ExportCombinedTranscript and by --convert
+void WriteCombinedTranscript(std::ostream& file, const std::vector<SpeakerSegment>& allSegments, std::time_t generated,
+                             const std::string& modelTier) {
+    file << "=== Combined Transcript ===" << std::endl;
+    file << "Generated: " << std::put_time(std::localtime(&generated), "%Y-%m-%d %H:%M:%S") << std::endl;
+    if (!modelTier.empty()) {
+        file << "Model tier: " << modelTier << std::endl;
+    }
+    file << "Total segments: " << allSegments.size() << std::endl;
+    file << std::endl;
+    
+    for (const auto& segment : allSegments) {
+        file << "[" << std::fixed << std::setprecision(2) << segment.start << "s - " 
+             << segment.end << "s] Speaker " << segment.speaker << ": " << segment.text << std::endl;
+    }
+}
+
+void ExportCombinedTranscript(const std::vector<SpeakerSegment>& allSegments, const std::string& filename,
+                              const std::string& modelTier = "",
+                              std::time_t generated = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now())) {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Error: Failed to create transcript file: " << filename << std::endl;
+        return;
+    }
+    
+    WriteCombinedTranscript(file, allSegments, generated, modelTier);
+    
+    file.close();
+    std::cout << "Combined transcript exported to: " << filename << std::endl;
+}
+
+std::string BinaryTranscriptFilename(const std::string& transcriptFilename) {
+    return std::filesystem::path(transcriptFilename).replace_extension(".tsb").string();
+}
+
+void ExportBinaryTranscript(const std::vector<SpeakerSegment>& allSegments, const std::string& filename,
+                            const std::string& modelTier, std::time_t generated) {
+    TranscriptFileWriter writer;
+    for (const auto& segment : allSegments) {
+        if (!writer.Add(segment.start, segment.end, segment.speaker, segment.text)) {
+            std::cerr << "Error: Transcript too large for the binary format: " << filename << std::endl;
+            return;
+        }
+    }
+    if (writer.Write(filename, static_cast<int64_t>(generated), modelTier)) {
+        std::cout << "Binary transcript exported to: " << filename << std::endl;
+    }
+}
+
+bool UseSingleSpeakerPath(TranscriptionEngine& engine, const TranscribeOptions& options, const std::string& wavFile,
+                          StageStats* stats) {
+    switch (options.singleSpeaker) {
+        case SingleSpeakerPolicy::Never: return false;
+        case SingleSpeakerPolicy::Microphone: return wavFile.find("_microphone") != std::string::npos;
+        case SingleSpeakerPolicy::Always: return true;
+        case SingleSpeakerPolicy::Auto: return engine.IsLikelySingleSpeaker(wavFile, options.singleSpeakerVariance, stats);
+    }
+    return false;
+}
+
+// Little-endian binary encoding shared by the daemon protocol, the transcript cache and
+// embedding sidecars
+class MessageWriter {
+private:
+    std::string buffer;
+    
+public:
+    void PutU32(uint32_t value) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            buffer.push_back(static_cast<char>((value >> shift) & 0xFF));
+        }
+    }
+    
+    void PutI32(int32_t value) {
+        PutU32(static_cast<uint32_t>(value));
+    }
+    
+    void PutF32(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        PutU32(bits);
+    }
+    
+    void PutString(const std::string& value) {
+        PutU32(static_cast<uint32_t>(value.size()));
+        buffer += value;
+    }
+    
+    const std::string& Data() const {
+        return buffer;
+    }
+};
+
+class MessageReader {
+private:
+    const std::string& buffer;
+    size_t offset;
+    bool ok;
+    
+public:
+    explicit MessageReader(const std::string& payload) : buffer(payload), offset(0), ok(true) {}
+    
+    uint32_t GetU32() {
+        if (!ok || buffer.size() - offset < 4) {
+            ok = false;
+            return 0;
+        }
+        uint32_t value = 0;
+        for (int b = 0; b < 4; ++b) {
+            value |= static_cast<uint32_t>(static_cast<unsigned char>(buffer[offset + b])) << (8 * b);
+        }
+        offset += 4;
+        return value;
+    }
+    
+    int32_t GetI32() {
+        return static_cast<int32_t>(GetU32());
+    }
+    
+    float GetF32() {
+        uint32_t bits = GetU32();
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    
+    std::string GetString() {
+        uint32_t length = GetU32();
+        if (!ok || buffer.size() - offset < length) {
+            ok = false;
+            return "";
+        }
+        std::string value = buffer.substr(offset, length);
+        offset += length;
+        return value;
+    }
+    
+    bool Ok() const {
+        return ok;
+    }
+};
+
+// Streaming XXH64 (https://github.com/Cyan4973/xxHash), used to fingerprint audio and models
+class Xxh64 {
+private:
+    static const uint64_t kPrime1 = 11400714785074694791ULL;
+    static const uint64_t kPrime2 = 14029467366897019727ULL;
+    static const uint64_t kPrime3 = 1609587929392839161ULL;
+    static const uint64_t kPrime4 = 9650029242287828579ULL;
+    static const uint64_t kPrime5 = 2870177450012600261ULL;
+    
+    uint64_t lanes[4];
+    unsigned char pending[32];
+    size_t pendingSize;
+    uint64_t totalSize;
+    
+    static uint64_t RotateLeft(uint64_t value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+    
+    static uint64_t Read64(const unsigned char* data) {
+        uint64_t value = 0;
+        for (int b = 7; b >= 0; --b) {
+            value = (value << 8) | data[b];
+        }
+        return value;
+    }
+    
+    static uint64_t Read32(const unsigned char* data) {
+        return static_cast<uint64_t>(data[0]) | (static_cast<uint64_t>(data[1]) << 8) |
+               (static_cast<uint64_t>(data[2]) << 16) | (static_cast<uint64_t>(data[3]) << 24);
+    }
+    
+    static uint64_t Round(uint64_t accumulator, uint64_t input) {
+        accumulator += input * kPrime2;
+        return RotateLeft(accumulator, 31) * kPrime1;
+    }
+    
+    static uint64_t MergeRound(uint64_t accumulator, uint64_t lane) {
+        accumulator ^= Round(0, lane);
+        return accumulator * kPrime1 + kPrime4;
+    }
+    
+    void ConsumeStripe(const unsigned char* stripe) {
+        for (int lane = 0; lane < 4; ++lane) {
+            lanes[lane] = Round(lanes[lane], Read64(stripe + 8 * lane));
+        }
+    }
+    
+public:
+    explicit Xxh64(uint64_t seed = 0) : pendingSize(0), totalSize(0) {
+        lanes[0] = seed + kPrime1 + kPrime2;
+        lanes[1] = seed + kPrime2;
+        lanes[2] = seed;
+        lanes[3] = seed - kPrime1;
+    }
+    
+    void Update(const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        totalSize += size;
+        
+        if (pendingSize > 0) {
+            size_t take = std::min(size, sizeof(pending) - pendingSize);
+            std::memcpy(pending + pendingSize, bytes, take);
+            pendingSize += take;
+            bytes += take;
+            size -= take;
+            if (pendingSize < sizeof(pending)) {
+                return;
+            }
+            ConsumeStripe(pending);
+            pendingSize = 0;
+        }
+        
+        for (; size >= 32; bytes += 32, size -= 32) {
+            ConsumeStripe(bytes);
+        }
+        
+        std::memcpy(pending, bytes, size);
+        pendingSize = size;
+    }
+    
+    uint64_t Digest() const {
+        uint64_t hash;
+        if (totalSize >= 32) {
+            hash = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) + RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18);
+            for (int lane = 0; lane < 4; ++lane) {
+                hash = MergeRound(hash, lanes[lane]);
+            }
+        } else {
+            hash = lanes[2] + kPrime5;
+        }
+        hash += totalSize;
+        
+        size_t offset = 0;
+        for (; offset + 8 <= pendingSize; offset += 8) {
+            hash ^= Round(0, Read64(pending + offset));
+            hash = RotateLeft(hash, 27) * kPrime1 + kPrime4;
+        }
+        if (offset + 4 <= pendingSize) {
+            hash ^= Read32(pending + offset) * kPrime1;
+            hash = RotateLeft(hash, 23) * kPrime2 + kPrime3;
+            offset += 4;
+        }
+        for (; offset < pendingSize; ++offset) {
+            hash ^= pending[offset] * kPrime5;
+            hash = RotateLeft(hash, 11) * kPrime1;
+        }
+        
+        hash ^= hash >> 33;
+        hash *= kPrime2;
+        hash ^= hash >> 29;
+        hash *= kPrime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+    
+    std::string HexDigest() const {
+        std::ostringstream hex;
+        hex << std::hex << std::setw(16) << std::setfill('0') << Digest();
+        return hex.str();
+    }
+};
+
+// Fingerprint of the model files (or every file under a model directory, apart from the
+// optimized copies the engine derives from them). Hashing a model reads it in full, so
+// results are remembered per path, size and modification time. With hashContents off only
+// that path, size and modification time go into the fingerprint and nothing is read.
+std::string ModelFingerprint(const std::vector<std::string>& modelPaths, bool hashContents = true) {
+    static std::mutex memoMutex;
+    static std::map<std::string, std::string> memo;
+    
+    Xxh64 fingerprint;
+    for (const auto& modelPath : modelPaths) {
+        std::vector<std::filesystem::path> files;
+        std::error_code ec;
+        if (std::filesystem::is_directory(modelPath, ec)) {
+            for (const auto& entry : std::filesystem::recursive_directory_iterator(modelPath, ec)) {
+                if (entry.is_regular_file(ec) && !IsOptimizedModelFile(entry.path())) {
+                    files.push_back(entry.path());
+                }
+            }
+            std::sort(files.begin(), files.end());
+        } else if (std::filesystem::exists(modelPath, ec)) {
+            files.push_back(modelPath);
+        }
+        
+        for (const auto& file : files) {
+            std::ostringstream identity;
+            identity << file.string() << '|' << std::filesystem::file_size(file, ec) << '|'
+                     << std::filesystem::last_write_time(file, ec).time_since_epoch().count();
+            
+            std::string digest = hashContents ? std::string() : identity.str();
+            if (digest.empty()) {
+                std::lock_guard<std::mutex> lock(memoMutex);
+                auto it = memo.find(identity.str());
+                if (it != memo.end()) {
+                    digest = it->second;
+                }
+            }
+            if (digest.empty()) {
+                Xxh64 content;
+                std::ifstream input(file, std::ios::binary);
+                std::vector<char> buffer(1 << 20);
+                while (input.read(buffer.data(), static_cast<std::streamsize>(buffer.size())) || input.gcount() > 0) {
+                    content.Update(buffer.data(), static_cast<size_t>(input.gcount()));
+                }
+                digest = content.HexDigest();
+                std::lock_guard<std::mutex> lock(memoMutex);
+                memo[identity.str()] = digest;
+            }
+            
+            std::string name = file.filename().string();
+            fingerprint.Update(name.data(), name.size());
+            fingerprint.Update(digest.data(), digest.size());
+        }
+    }
+    return fingerprint.HexDigest();
+}
+
+// Per-file transcripts stored under a directory, keyed by a hash of the audio samples, the
+// model files and every setting that affects the result. Entries are evicted least recently
+// used first once the directory grows past its size budget.
+class TranscriptCache {
+private:
+    static const uint32_t kMagic = 0x48435254;  // "TRCH"
+    static const uint32_t kVersion = 1;
+    
+    std::filesystem::path directory;
+    uint64_t maxBytes;
+    int hits;
+    int misses;
+    int evictions;
+    
+    std::filesystem::path EntryPath(const std::string& key) const {
+        return directory / (key.substr(0, 16) + ".seg");
+    }
+    
+    // Deletes the least recently used entries until the directory fits in maxBytes
+    void Evict() {
+        std::error_code ec;
+        std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> entries;
+        uint64_t totalBytes = 0;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+            if (entry.path().extension() == ".seg") {
+                entries.emplace_back(entry.last_write_time(ec), entry.path());
+                totalBytes += entry.file_size(ec);
+            }
+        }
+        if (totalBytes <= maxBytes) {
+            return;
+        }
+        
+        std::sort(entries.begin(), entries.end());
+        for (const auto& entry : entries) {
+            if (totalBytes <= maxBytes) {
+                break;
+            }
+            uint64_t size = std::filesystem::file_size(entry.second, ec);
+            if (std::filesystem::remove(entry.second, ec)) {
+                totalBytes -= std::min(totalBytes, size);
+                ++evictions;
+            }
+        }
+    }
+    
+public:
+    struct Entry {
+        std::vector<SpeakerSegment> segments;  // With the file's own speaker IDs
+        bool singleSpeaker = false;
+        std::map<int, std::vector<float>> speakerEmbeddings;  // Empty unless speakers were clustered
+    };
+    
+    // An empty directory disables the cache
+    TranscriptCache(const std::string& cacheDirectory, uint64_t maxSizeBytes)
+        : directory(cacheDirectory), maxBytes(maxSizeBytes), hits(0), misses(0), evictions(0) {
+        if (!directory.empty()) {
+            std::error_code ec;
+            std::filesystem::create_directories(directory, ec);
+        }
+    }
+    
+    bool Enabled() const {
+        return !directory.empty();
+    }
+    
+    // Full cache key of a file: audio hash followed by the settings it was transcribed with.
+    // Empty if the file cannot be read.
+    static std::string Key(const std::string& wavFile, const std::string& settings, double& audioSeconds) {
+        WavReader reader;
+        if (!reader.Open(wavFile)) {
+            return "";
+        }
+        audioSeconds = reader.Seconds();
+        
+        // The raw sample bytes are hashed straight from the mapping, without converting them
+        int32_t format[3] = {reader.SampleRate(), reader.Channels(), reader.IsFloat() ? -reader.BitsPerSample() : reader.BitsPerSample()};
+        Xxh64 audio;
+        audio.Update(format, sizeof(format));
+        audio.Update(reader.Data(), static_cast<size_t>(reader.DataBytes()));
+        
+        Xxh64 combined;
+        std::string audioHash = audio.HexDigest();
+        combined.Update(audioHash.data(), audioHash.size());
+        combined.Update(settings.data(), settings.size());
+        return combined.HexDigest() + "|" + audioHash + "|" + settings;
+    }
+    
+    bool Lookup(const std::string& key, Entry& entry) {
+        std::filesystem::path path = EntryPath(key);
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            ++misses;
+            return false;
+        }
+        std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        file.close();
+        
+        // The stored key guards against hash collisions
+        MessageReader reader(data);
+        bool valid = reader.GetU32() == kMagic && reader.GetU32() == kVersion && reader.GetString() == key;
+        
+        entry.singleSpeaker = reader.GetU32() != 0;
+        uint32_t numSegments = reader.GetU32();
+        for (uint32_t i = 0; valid && i < numSegments && reader.Ok(); ++i) {
+            SpeakerSegment segment;
+            segment.start = reader.GetF32();
+            segment.end = reader.GetF32();
+            segment.speaker = reader.GetI32();
+            segment.text = reader.GetString();
+            entry.segments.push_back(segment);
+        }
+        uint32_t numSpeakers = reader.GetU32();
+        for (uint32_t i = 0; valid && i < numSpeakers && reader.Ok(); ++i) {
+            int speaker = reader.GetI32();
+            uint32_t dim = reader.GetU32();
+            std::vector<float>& embedding = entry.speakerEmbeddings[speaker];
+            for (uint32_t d = 0; d < dim && reader.Ok(); ++d) {
+                embedding.push_back(reader.GetF32());
+            }
+        }
+        
+        // A file without speech is a valid entry with no segments
+        if (!valid || !reader.Ok()) {
+            entry = Entry();
+            ++misses;
+            return false;
+        }
+        
+        // Touch the entry so eviction sees it as recently used
+        std::error_code ec;
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+        ++hits;
+        return true;
+    }
+    
+    void Store(const std::string& key, const Entry& entry) {
+        MessageWriter writer;
+        writer.PutU32(kMagic);
+        writer.PutU32(kVersion);
+        writer.PutString(key);
+        writer.PutU32(entry.singleSpeaker ? 1 : 0);
+        writer.PutU32(static_cast<uint32_t>(entry.segments.size()));
+        for (const auto& segment : entry.segments) {
+            writer.PutF32(segment.start);
+            writer.PutF32(segment.end);
+            writer.PutI32(segment.speaker);
+            writer.PutString(segment.text);
+        }
+        writer.PutU32(static_cast<uint32_t>(entry.speakerEmbeddings.size()));
+        for (const auto& pair : entry.speakerEmbeddings) {
+            writer.PutI32(pair.first);
+            writer.PutU32(static_cast<uint32_t>(pair.second.size()));
+            for (float value : pair.second) {
+                writer.PutF32(value);
+            }
+        }
+        
+        // Write to a temporary name first so concurrent readers never see a partial entry
+        std::filesystem::path path = EntryPath(key);
+        std::filesystem::path temporary = path;
+        temporary += "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary);
+            if (!file.is_open()) {
+                std::cerr << "Warning: Could not write cache entry " << path.string() << std::endl;
+                return;
+            }
+            file.write(writer.Data().data(), static_cast<std::streamsize>(writer.Data().size()));
+        }
+        std::error_code ec;
+        std::filesystem::rename(temporary, path, ec);
+        if (ec) {
+            std::filesystem::remove(temporary, ec);
+            return;
+        }
+        
+        Evict();
+    }
+    
+    void PrintStats() const {
+        std::cout << "Transcript cache: " << hits << " hit(s), " << misses << " miss(es), "
+                  << evictions << " evicted (" << directory.string() << ")" << std::endl;
+    }
+};
+
+// The speakers one file contributed to a recording set
+struct FileSpeakers {
+    bool isMicrophone;
+    size_t firstSegment;  // Range of the file's segments in the combined list
+    size_t endSegment;
+    int speakerIdOffset;  // Added to the file's own speaker IDs in the combined list
+    std::map<int, std::vector<float>> embeddings;
+};
+
+// Gives speakers consistent IDs across the files of a recording by clustering their
+// embeddings, so the same voice gets the same ID whichever file it was heard in. Microphone
+// speakers are numbered first. Speakers without an embedding keep an ID of their own.
+void ClusterSpeakersAcrossFiles(const std::vector<FileSpeakers>& files, float threshold, std::vector<SpeakerSegment>& segments) {
+    auto start = std::chrono::steady_clock::now();
+    
+    std::vector<size_t> order;
+    for (size_t f = 0; f < files.size(); ++f) {
+        order.push_back(f);
+    }
+    std::stable_sort(order.begin(), order.end(), [&files](size_t a, size_t b) {
+        return files[a].isMicrophone && !files[b].isMicrophone;
+    });
+    
+    std::vector<std::vector<float>> embeddings;
+    std::vector<int> groups;
+    std::vector<std::pair<size_t, int>> owners;  // (file, file speaker ID) of each embedding
+    for (size_t f : order) {
+        for (const auto& pair : files[f].embeddings) {
+            embeddings.push_back(pair.second);
+            groups.push_back(static_cast<int>(f));
+            owners.emplace_back(f, pair.first);
+        }
+    }
+    
+    std::vector<int> labels = ClusterEmbeddings(embeddings, groups, threshold);
+    std::map<std::pair<size_t, int>, int> finalIds;
+    int numSpeakers = 0;
+    for (size_t i = 0; i < owners.size(); ++i) {
+        finalIds[owners[i]] = labels[i];
+        numSpeakers = std::max(numSpeakers, labels[i] + 1);
+    }
+    
+    size_t fileSpeakers = owners.size();
+    for (size_t f : order) {
+        for (size_t s = files[f].firstSegment; s < files[f].endSegment; ++s) {
+            auto key = std::make_pair(f, segments[s].speaker - files[f].speakerIdOffset);
+            auto it = finalIds.find(key);
+            if (it == finalIds.end()) {
+                it = finalIds.emplace(key, numSpeakers++).first;
+                ++fileSpeakers;
+            }
+            segments[s].speaker = it->second;
+        }
+    }
+    
+    std::cout << "Clustered speakers across files: " << fileSpeakers << " -> " << numSpeakers << " in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+              << " ms" << std::endl;
+}
+
+// Everything --recluster needs to reassign speakers without running the models again: every
+// transcribed segment with its speaker embedding, grouped by input file
+struct EmbeddingSidecar {
+    struct File {
+        std::string path;
+        bool singleSpeaker;  // Transcribed without diarization; its segments stay one speaker
+    };
+    
+    struct Segment {
+        uint32_t file;
+        SpeakerSegment segment;  // Speaker as assigned by the original run
+        std::vector<float> embedding;  // Empty if the segment was too short to embed
+    };
+    
+    std::vector<File> files;
+    std::vector<Segment> segments;
+};
+
+// Everything besides the audio that determines a file's transcript. With hashModels off the
+// models are identified by path, size and modification time instead of their contents
+std::string CacheSettings(const TranscriptionEngine& engine, const TranscribeOptions& options, const std::string& wavFile,
+                          bool hashModels = true) {
+    std::ostringstream settings;
+    settings << "models=" << ModelFingerprint(engine.ModelPaths(), hashModels)
+             << ";mode=" << static_cast<int>(options.mode)
+             << ";single=" << static_cast<int>(options.singleSpeaker) << "," << options.singleSpeakerVariance
+             << ",mic=" << (wavFile.find("_microphone") != std::string::npos)
+             << ";decode=" << options.decode.maxSegmentSeconds << "," << options.decode.mergeGapSeconds
+             << ";diarize=" << options.diarization.chunkSeconds << "," << options.diarization.chunkOverlapSeconds
+             << "," << options.diarization.linkThreshold;
+    if (!options.decode.asrModel.empty() && options.decode.asrModel != engine.MainModelPath()) {
+        settings << ";asr=" << ModelFingerprint({options.decode.asrModel}, hashModels);
+    }
+    if (options.decode.cascade) {
+        settings << ";cascade=" << ModelFingerprint({engine.FastModelPath()}, hashModels) << "," << options.decode.cascadeThreshold;
+    }
+    return settings.str();
+}
+
+// Reads the upcoming files of a recording set on a background thread while the current one
+// is transcribed, so their pages are already in the OS file cache when the engine maps them
+// and the compute threads do not stall on slow (e.g. network) storage. At most budgetBytes
+// of each file are read ahead, which bounds how much of the file cache the read-ahead can
+// take from the file that is being processed.
+class FilePrefetcher {
+private:
+    uint64_t budgetBytes;
+    BoundedQueue<std::string> paths;
+    std::atomic<bool> stopping{false};
+    std::thread worker;
+    
+    void Run() {
+        const size_t kReadBytes = 4 * 1024 * 1024;
+        std::vector<char> buffer(kReadBytes);
+        std::string path;
+        while (!stopping && paths.Pop(path)) {
+            auto start = std::chrono::steady_clock::now();
+            std::ifstream file(path, std::ios::binary);
+            uint64_t bytesRead = 0;
+            while (file && bytesRead < budgetBytes && !stopping) {
+                file.read(buffer.data(), static_cast<std::streamsize>(std::min<uint64_t>(kReadBytes, budgetBytes - bytesRead)));
+                bytesRead += static_cast<uint64_t>(file.gcount());
+            }
+            double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::ostringstream line;
+            line << std::fixed << std::setprecision(1) << "Prefetched " << bytesRead / (1024.0 * 1024.0) << " MB of "
+                 << path << " in " << elapsedMs << " ms";
+            std::cout << line.str() << std::endl;
+        }
+    }
+    
+public:
+    explicit FilePrefetcher(uint64_t budgetBytes) : budgetBytes(budgetBytes), paths(16) {
+        if (budgetBytes > 0) {
+            worker = std::thread(&FilePrefetcher::Run, this);
+        }
+    }
+    
+    ~FilePrefetcher() {
+        stopping = true;
+        paths.Close();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    
+    // Queues a file to be read ahead; files are read one after another in queue order
+    void Prefetch(const std::string& path) {
+        if (worker.joinable()) {
+            paths.Push(path);
+        }
+    }
+};
+
+// Scans a track's levels; silent tracks are skipped without running any model
+bool IsSilentTrack(const std::string& wavFile, const SilenceSettings& settings, StageStats* stats) {
+    StageTimer timer(stats, "silence_scan");
+    WavReader wav;
+    if (!wav.Open(wavFile)) {
+        return false;
+    }
+    TrackLevels levels = ScanLevels(wav);
+    if (stats) {
+        stats->SetAudioSeconds(wav.Seconds());
+    }
+    std::cout << std::fixed << std::setprecision(1) << "Levels: RMS " << levels.rmsDb << " dBFS, peak " << levels.peakDb
+              << " dBFS" << std::defaultfloat << std::setprecision(6) << std::endl;
+    return IsSilent(levels, settings);
+}
+
+struct RecordingSetResult {
+    std::vector<SpeakerSegment> segments;
+    std::string transcriptFilename;
+    EmbeddingSidecar sidecar;  // Filled with --save-embeddings
+    std::vector<std::unique_ptr<StageStats>> fileStats;
+    std::unique_ptr<StageStats> recordingStats{new StageStats("recording")};  // Stages that span all files
+    std::vector<std::string> journalFiles;  // Removed once the transcript is written
+    double wallSeconds = 0.0;               // End to end, from the first file to the sorted transcript
+    int failedFiles = 0;                    // Tracks that could not be transcribed (not those without speech)
+};
+
+// Journal of a track, kept next to the transcript until the transcript is written
+std::string JournalFilename(const TranscribeOptions& options, const std::string& wavFile) {
+    std::string name = std::filesystem::path(wavFile).stem().string() + ".journal";
+    return options.outputDirectory.empty() ? name : (std::filesystem::path(options.outputDirectory) / name).string();
+}
+
+void RemoveJournals(const std::vector<std::string>& journalFiles) {
+    for (const auto& file : journalFiles) {
+        std::error_code ec;
+        std::filesystem::remove(file, ec);
+    }
+}
+
+// Transcribes the tracks of one recording and merges them into a single time-ordered list
+RecordingSetResult ProcessRecordingSet(TranscriptionEngine& engine, const TranscribeOptions& options,
+                                       const SegmentCallback& onSegment = nullptr) {
+    RecordingSetResult result;
+    auto setStart = std::chrono::steady_clock::now();
+    int maxMicrophoneSpeakerId = -1;
+    size_t numFiles = options.inputFiles.size();
+    std::vector<FileSpeakers> fileSpeakers;
+    TranscriptCache cache(options.cacheDirectory, static_cast<uint64_t>(options.cacheMaxMb) * 1024 * 1024);
+    FilePrefetcher prefetcher(numFiles > 1 ? static_cast<uint64_t>(options.prefetchMb) * 1024 * 1024 : 0);
+    
+    // The offset IDs streamed while files are being processed are provisional when several
+    // diarized files are combined; the transcript uses the clustered ones
+    bool clusterSpeakers = options.mode == TranscriptionMode::Diarize && options.clusterSpeakers && numFiles > 1;
+    
+    std::cout << "Processing " << numFiles << " audio file(s)..." << std::endl;
+    std::cout << std::endl;
+    
+    unsigned pendingModels = options.deferredModels;
+    
+    // Process each audio file
+    for (size_t i = 0; i < numFiles; i++) {
+        const std::string& wavFile = options.inputFiles[i];
+        std::cout << "[" << (i + 1) << "/" << numFiles << "] Processing: " << wavFile << std::endl;
+        if (i + 1 < numFiles) {
+            prefetcher.Prefetch(options.inputFiles[i + 1]);
+        }
+        
+        result.fileStats.emplace_back(new StageStats(wavFile));
+        StageStats* stats = result.fileStats.back().get();
+        
+        // Determine if this is microphone or system audio based on filename
+        bool isMicrophoneAudio = wavFile.find("_microphone") != std::string::npos;
+        int speakerIdOffset = isMicrophoneAudio ? 0 : maxMicrophoneSpeakerId + 1;
+        
+        // Stream segments with the speaker IDs they will have in the combined transcript
+        SegmentCallback forward;
+        if (onSegment) {
+            forward = [&onSegment, speakerIdOffset](const SpeakerSegment& segment) {
+                SpeakerSegment remapped = segment;
+                remapped.speaker += speakerIdOffset;
+                onSegment(remapped);
+            };
+        }
+        
+        if (options.silence.enabled && IsSilentTrack(wavFile, options.silence, stats)) {
+            std::cout << "Skipped silent track: " << wavFile << std::endl;
+            std::cout << std::endl;
+            continue;
+        }
+        
+        std::vector<SpeakerSegment> segments;
+        bool singleSpeaker = true;
+        bool transcribed = true;  // False if a model or the file failed, as opposed to finding no speech
+        
+        std::string cacheKey;
+        TranscriptCache::Entry cached;
+        bool cacheHit = false;
+        if (cache.Enabled()) {
+            StageTimer timer(stats, "cache_lookup");
+            double audioSeconds = 0.0;
+            cacheKey = TranscriptCache::Key(wavFile, CacheSettings(engine, options, wavFile), audioSeconds);
+            cacheHit = !cacheKey.empty() && cache.Lookup(cacheKey, cached);
+            stats->SetAudioSeconds(audioSeconds);
+        }
+        bool storeInCache = !cacheKey.empty() && !cacheHit;
+        
+        // The first track that needs the models loads them side by side, as main would have
+        if (pendingModels != 0 && !cacheHit) {
+            StageTimer timer(stats, "model_load");
+            if (!engine.Initialize(pendingModels, options.warmUp)) {
+                std::cerr << "Error: Failed to load the transcription models" << std::endl;
+            }
+            pendingModels = 0;
+        }
+        
+        // The journal is keyed by the audio and every setting that affects the result, like the
+        // cache, but identifies the models by path, size and modification time so that opening
+        // it never reads the models in full
+        SegmentJournal journal;
+        SegmentJournal* activeJournal = nullptr;
+        if (options.journal && !cacheHit) {
+            StageTimer timer(stats, "journal_open");
+            double audioSeconds = 0.0;
+            std::string journalKey = TranscriptCache::Key(wavFile, CacheSettings(engine, options, wavFile, false), audioSeconds);
+            if (!journalKey.empty() && journal.Open(JournalFilename(options, wavFile), journalKey)) {
+                activeJournal = &journal;
+                result.journalFiles.push_back(journal.Path());
+            }
+        }
+        
+        if (cacheHit) {
+            std::cout << "Cache hit: reusing the stored transcript" << std::endl;
+            segments = cached.segments;
+            singleSpeaker = cached.singleSpeaker;
+            if (forward) {
+                for (const auto& segment : segments) {
+                    forward(segment);
+                }
+            }
+        } else if (options.mode != TranscriptionMode::Diarize) {
+            transcribed = engine.TranscribeWithVad(wavFile, options.mode == TranscriptionMode::NoDiarize, segments, forward, stats,
+                                                   options.decode, activeJournal);
+        } else if (UseSingleSpeakerPath(engine, options, wavFile, stats)) {
+            std::cout << "Single-speaker fast path: skipping diarization" << std::endl;
+            transcribed = engine.TranscribeWithVad(wavFile, true, segments, forward, stats, options.decode, activeJournal);
+        } else {
+            singleSpeaker = false;
+            // Try speaker diarization first. If it fails part way the segments are only a prefix of
+            // the track, which must not be exported or cached as its transcript; the journal keeps
+            // them for the next run. A failure before any speech falls back to the VAD below.
+            bool diarized = engine.TranscribeWithDiarization(wavFile, options.diarization, options.decode, segments, forward, stats,
+                                                             activeJournal);
+            transcribed = diarized || segments.empty();
+        }
+        
+        if (segments.empty() && !cacheHit && transcribed && options.mode == TranscriptionMode::Diarize) {
+            std::cout << "No speaker segments found, falling back to VAD-only transcription" << std::endl;
+            transcribed = engine.TranscribeWithVad(wavFile, true, segments, forward, stats, options.decode, activeJournal);
+        }
+        
+        // A track without speech is cached too, so that it is not diarized and decoded again
+        if (segments.empty() && transcribed && storeInCache) {
+            cached.segments.clear();
+            cached.singleSpeaker = singleSpeaker;
+            cache.Store(cacheKey, cached);
+        }
+        
+        if (transcribed && !segments.empty()) {
+            std::cout << "Found " << segments.size() << " speaker segments" << std::endl;
+            
+            if (clusterSpeakers) {
+                FileSpeakers speakers;
+                speakers.isMicrophone = isMicrophoneAudio;
+                speakers.firstSegment = result.segments.size();
+                speakers.endSegment = result.segments.size() + segments.size();
+                speakers.speakerIdOffset = speakerIdOffset;
+                if (cacheHit && !cached.speakerEmbeddings.empty()) {
+                    speakers.embeddings = cached.speakerEmbeddings;
+                } else {
+                    speakers.embeddings = engine.SpeakerEmbeddings(wavFile, segments, stats);
+                    cached.speakerEmbeddings = speakers.embeddings;
+                    storeInCache = !cacheKey.empty();
+                }
+                fileSpeakers.push_back(std::move(speakers));
+            }
+            
+            if (storeInCache) {
+                cached.segments = segments;
+                cached.singleSpeaker = singleSpeaker;
+                cache.Store(cacheKey, cached);
+            }
+            
+            if (options.saveEmbeddings && options.mode != TranscriptionMode::VadOnly) {
+                uint32_t fileIndex = static_cast<uint32_t>(result.sidecar.files.size());
+                result.sidecar.files.push_back({std::filesystem::absolute(wavFile).string(), singleSpeaker});
+                std::vector<std::vector<float>> embeddings = engine.SegmentEmbeddings(wavFile, segments, options.decode.workers, stats);
+                for (size_t s = 0; s < segments.size(); ++s) {
+                    result.sidecar.segments.push_back({fileIndex, segments[s], std::move(embeddings[s])});
+                }
+            }
+            
+            // Remap speaker IDs to ensure distinct identities
+            for (auto& segment : segments) {
+                segment.speaker += speakerIdOffset;
+                
+                // Track the maximum speaker ID for microphone audio
+                if (isMicrophoneAudio) {
+                    maxMicrophoneSpeakerId = std::max(maxMicrophoneSpeakerId, segment.speaker);
+                }
+                
+                result.segments.push_back(segment);
+            }
+            
+            // Generate transcript filename from the first audio file
+            if (result.transcriptFilename.empty()) {
+                result.transcriptFilename = GenerateTranscriptFilename(wavFile);
+                if (!options.outputDirectory.empty()) {
+                    result.transcriptFilename = (std::filesystem::path(options.outputDirectory) / result.transcriptFilename).string();
+                }
+            }
+            
+            std::cout << "Successfully processed: " << wavFile << std::endl;
+        } else if (transcribed) {
+            std::cout << "No speech found in: " << wavFile << std::endl;
+        } else {
+            std::cout << "Failed to process: " << wavFile << std::endl;
+            ++result.failedFiles;
+        }
+        
+        std::cout << std::endl;
+    }
+    
+    if (cache.Enabled()) {
+        cache.PrintStats();
+    }
+    
+    if (clusterSpeakers && fileSpeakers.size() > 1) {
+        StageTimer timer(result.recordingStats.get(), "speaker_clustering");
+        ClusterSpeakersAcrossFiles(fileSpeakers, options.speakerClusterThreshold, result.segments);
+    }
+    
+    // Sort all segments by start time
+    std::sort(result.segments.begin(), result.segments.end(), 
+              [](const SpeakerSegment& a, const SpeakerSegment& b) {
+                  return a.start < b.start;
+              });
+    
+    // Without segments there is no transcript to write, and nothing left to resume unless a track failed
+    if (result.segments.empty() && result.failedFiles == 0) {
+        RemoveJournals(result.journalFiles);
+    }
+    
+    result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - setStart).count();
+    return result;
+}
+
+void PrintTranscriptSummary(const std::vector<SpeakerSegment>& allSegments) {
+    // Display combined results
+    std::cout << "=== Combined Transcript Summary ===" << std::endl;
+    std::cout << "Total segments: " << allSegments.size() << std::endl;
+    
+    // Group by speaker for summary
+    std::map<int, std::vector<SpeakerSegment>> speakerGroups;
+    for (const auto& segment : allSegments) {
+        speakerGroups[segment.speaker].push_back(segment);
+    }
+    
+    std::cout << "Speakers found: " << speakerGroups.size() << std::endl;
+    for (const auto& pair : speakerGroups) {
+        int speakerId = pair.first;
+        const auto& speakerSegments = pair.second;
+        std::cout << "  Speaker " << speakerId << " (" << speakerSegments.size() << " segments)" << std::endl;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Daemon protocol
+//
+// Every message is a frame: u32 payload length (little endian), u8 message type, payload.
+// Payload fields are u32 / i32 / f32 in little endian and strings as u32 length + bytes,
+// encoded with MessageWriter / MessageReader.
+//
+//   client -> daemon  JobRequest  u32 version, str working directory, u32 argc, argc x str
+//   daemon -> client  Status      str message (e.g. queued, started)
+//   daemon -> client  Segment     f32 start, f32 end, i32 speaker, str text
+//   daemon -> client  Done        str transcript path, u32 number of segments
+//   daemon -> client  Error       str message
+// ---------------------------------------------------------------------------
+
+const uint32_t kProtocolVersion = 1;
+const uint32_t kMaxFrameSize = 64 * 1024 * 1024;
+
+enum class MessageType : uint8_t {
+    JobRequest = 'J',
+    Status = 'I',
+    Segment = 'S',
+    Done = 'D',
+    Error = 'E'
+};
+
+// Embedding sidecars use the same little-endian encoding as the daemon protocol
+const uint32_t kSidecarMagic = 0x424D4554;  // "TEMB"
+const uint32_t kSidecarVersion = 1;
+
+std::string SidecarFilename(const std::string& transcriptFilename) {
+    return std::filesystem::path(transcriptFilename).replace_extension(".emb").string();
+}
+
+bool WriteEmbeddingSidecar(const EmbeddingSidecar& sidecar, const std::string& filename) {
+    MessageWriter writer;
+    writer.PutU32(kSidecarMagic);
+    writer.PutU32(kSidecarVersion);
+    
+    writer.PutU32(static_cast<uint32_t>(sidecar.files.size()));
+    for (const auto& file : sidecar.files) {
+        writer.PutString(file.path);
+        writer.PutU32(file.singleSpeaker ? 1 : 0);
+    }
+    
+    writer.PutU32(static_cast<uint32_t>(sidecar.segments.size()));
+    for (const auto& entry : sidecar.segments) {
+        writer.PutU32(entry.file);
+        writer.PutF32(entry.segment.start);
+        writer.PutF32(entry.segment.end);
+        writer.PutI32(entry.segment.speaker);
+        writer.PutString(entry.segment.text);
+        writer.PutU32(static_cast<uint32_t>(entry.embedding.size()));
+        for (float value : entry.embedding) {
+            writer.PutF32(value);
+        }
+    }
+    
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not create file " << filename << std::endl;
+        return false;
+    }
+    file.write(writer.Data().data(), static_cast<std::streamsize>(writer.Data().size()));
+    std::cout << "Speaker embeddings saved to: " << filename << std::endl;
+    return true;
+}
+
+bool ReadEmbeddingSidecar(const std::string& filename, EmbeddingSidecar& sidecar) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open file " << filename << std::endl;
+        return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    
+    MessageReader reader(data);
+    if (reader.GetU32() != kSidecarMagic || reader.GetU32() != kSidecarVersion) {
+        std::cerr << "Error: Not a speaker embedding file: " << filename << std::endl;
+        return false;
+    }
+    
+    uint32_t numFiles = reader.GetU32();
+    for (uint32_t f = 0; f < numFiles && reader.Ok(); ++f) {
+        EmbeddingSidecar::File entry;
+        entry.path = reader.GetString();
+        entry.singleSpeaker = reader.GetU32() != 0;
+        sidecar.files.push_back(entry);
+    }
+    
+    uint32_t numSegments = reader.GetU32();
+    for (uint32_t i = 0; i < numSegments && reader.Ok(); ++i) {
+        EmbeddingSidecar::Segment entry;
+        entry.file = reader.GetU32();
+        entry.segment.start = reader.GetF32();
+        entry.segment.end = reader.GetF32();
+        entry.segment.speaker = reader.GetI32();
+        entry.segment.text = reader.GetString();
+        uint32_t dim = reader.GetU32();
+        for (uint32_t d = 0; d < dim && reader.Ok(); ++d) {
+            entry.embedding.push_back(reader.GetF32());
+        }
+        if (entry.file >= sidecar.files.size()) {
+            break;
+        }
+        sidecar.segments.push_back(std::move(entry));
+    }
+    
+    if (!reader.Ok() || sidecar.segments.size() != numSegments) {
+        std::cerr << "Error: Truncated or corrupt speaker embedding file: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Assigns speakers from scratch by clustering the saved segment embeddings. The threshold is
+// a cosine distance, like the diarization pipeline's clustering threshold. Segments of a
+// single-speaker file are clustered as one unit; segments without an embedding take the
+// speaker of the closest embedded segment of the same file.
+std::vector<SpeakerSegment> ReclusterSpeakers(const EmbeddingSidecar& sidecar, float threshold) {
+    // Microphone files first, so the local user keeps the lowest speaker ID
+    std::vector<uint32_t> fileOrder;
+    for (uint32_t f = 0; f < sidecar.files.size(); ++f) {
+        fileOrder.push_back(f);
+    }
+    std::stable_sort(fileOrder.begin(), fileOrder.end(), [&sidecar](uint32_t a, uint32_t b) {
+        return sidecar.files[a].path.find("_microphone") != std::string::npos &&
+               sidecar.files[b].path.find("_microphone") == std::string::npos;
+    });
+    
+    // Clustering units: one per embedded segment, or one per single-speaker file
+    std::vector<std::vector<float>> units;
+    std::vector<int> unitOf(sidecar.segments.size(), -1);
+    for (uint32_t f : fileOrder) {
+        int fileUnit = -1;
+        for (size_t i = 0; i < sidecar.segments.size(); ++i) {
+            const auto& entry = sidecar.segments[i];
+            if (entry.file != f || entry.embedding.empty()) {
+                continue;
+            }
+            if (!sidecar.files[f].singleSpeaker) {
+                unitOf[i] = static_cast<int>(units.size());
+                units.push_back(entry.embedding);
+                continue;
+            }
+            if (fileUnit < 0) {
+                fileUnit = static_cast<int>(units.size());
+                units.emplace_back(entry.embedding.size(), 0.0f);
+            }
+            for (size_t d = 0; d < entry.embedding.size() && d < units[fileUnit].size(); ++d) {
+                units[fileUnit][d] += entry.embedding[d];
+            }
+            unitOf[i] = fileUnit;
+        }
+    }
+    
+    std::vector<int> labels = ClusterEmbeddings(units, std::vector<int>(units.size(), -1), 1.0f - threshold);
+    int numSpeakers = 0;
+    for (int label : labels) {
+        numSpeakers = std::max(numSpeakers, label + 1);
+    }
+    
+    std::vector<SpeakerSegment> segments;
+    for (uint32_t f : fileOrder) {
+        std::vector<size_t> fileSegments;
+        for (size_t i = 0; i < sidecar.segments.size(); ++i) {
+            if (sidecar.segments[i].file == f) {
+                fileSegments.push_back(i);
+            }
+        }
+        
+        int fallbackSpeaker = -1;
+        for (size_t i : fileSegments) {
+            SpeakerSegment segment = sidecar.segments[i].segment;
+            if (unitOf[i] >= 0) {
+                segment.speaker = labels[unitOf[i]];
+            } else {
+                float bestDistance = std::numeric_limits<float>::max();
+                segment.speaker = -1;
+                for (size_t j : fileSegments) {
+                    const SpeakerSegment& other = sidecar.segments[j].segment;
+                    float distance = std::abs((other.start + other.end) - (segment.start + segment.end));
+                    if (unitOf[j] >= 0 && distance < bestDistance) {
+                        bestDistance = distance;
+                        segment.speaker = labels[unitOf[j]];
+                    }
+                }
+                if (segment.speaker < 0) {
+                    if (fallbackSpeaker < 0) {
+                        fallbackSpeaker = numSpeakers++;
+                    }
+                    segment.speaker = fallbackSpeaker;
+                }
+            }
+            segments.push_back(segment);
+        }
+    }
+    
+    std::sort(segments.begin(), segments.end(), [](const SpeakerSegment& a, const SpeakerSegment& b) {
+        return a.start < b.start;
+    });
+    return segments;
+}
+
+int RunRecluster(const TranscribeOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    
+    EmbeddingSidecar sidecar;
+    if (!ReadEmbeddingSidecar(options.reclusterFile, sidecar)) {
+        return 1;
+    }
+    
+    std::vector<SpeakerSegment> segments = ReclusterSpeakers(sidecar, options.reclusterThreshold);
+    
+    std::ostringstream suffix;
+    suffix << "_t" << std::fixed << std::setprecision(2) << options.reclusterThreshold << ".txt";
+    std::filesystem::path transcript = std::filesystem::path(options.reclusterFile).replace_extension("");
+    transcript += suffix.str();
+    if (!options.outputDirectory.empty()) {
+        transcript = std::filesystem::path(options.outputDirectory) / transcript.filename();
+    }
+    
+    std::cout << "Re-clustered " << segments.size() << " segments at threshold " << options.reclusterThreshold << " in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+              << " ms" << std::endl;
+    PrintTranscriptSummary(segments);
+    ExportCombinedTranscript(segments, transcript.string());
+    return 0;
+}
+
+void WriteTranscriptJson(std::ostream& file, const MappedTranscript& transcript) {
+    std::time_t generated = static_cast<std::time_t>(transcript.GeneratedAt());
+    file << "{" << std::endl;
+    file << "  \"version\": " << transcript.Version() << "," << std::endl;
+    file << "  \"generated\": \"" << std::put_time(std::localtime(&generated), "%Y-%m-%d %H:%M:%S") << "\"," << std::endl;
+    file << "  \"model_tier\": \"" << JsonEscape(std::string(transcript.ModelTier())) << "\"," << std::endl;
+    file << "  \"sample_rate\": " << transcript.SampleRate() << "," << std::endl;
+    file << "  \"segments\": [" << std::endl;
+    file << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < transcript.Size(); ++i) {
+        const TranscriptSegmentRecord& segment = transcript.Segment(i);
+        file << "    {\"start\": " << transcript.StartSeconds(i) << ", \"end\": " << transcript.EndSeconds(i)
+             << ", \"start_sample\": " << segment.startSample << ", \"end_sample\": " << segment.endSample
+             << ", \"speaker\": " << segment.speaker << ", \"text\": \"" << JsonEscape(std::string(transcript.Text(i))) << "\"}"
+             << (i + 1 < transcript.Size() ? "," : "") << std::endl;
+    }
+    file << "  ]" << std::endl;
+    file << "}" << std::endl;
+}
+
+// Renders a binary transcript next to it (or into the output directory) as the text transcript or as JSON
+int RunConvert(const TranscribeOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    
+    MappedTranscript transcript;
+    if (!transcript.Open(options.convertFile)) {
+        return 1;
+    }
+    
+    // The text keeps clear of the transcript the binary was saved with, which has the same stem
+    bool json = options.convertFormat == "json";
+    std::filesystem::path output = std::filesystem::path(options.convertFile).replace_extension("");
+    output += json ? ".json" : "_converted.txt";
+    if (!options.outputDirectory.empty()) {
+        output = std::filesystem::path(options.outputDirectory) / output.filename();
+    }
+    std::ofstream file(output);
+    if (!file.is_open()) {
+        std::cerr << "Error: Failed to create " << output.string() << std::endl;
+        return 1;
+    }
+    
+    if (json) {
+        WriteTranscriptJson(file, transcript);
+    } else {
+        // Times go through float like SpeakerSegment's, so the text matches the original transcript
+        std::vector<SpeakerSegment> segments(transcript.Size());
+        for (size_t i = 0; i < transcript.Size(); ++i) {
+            segments[i].start = static_cast<float>(transcript.StartSeconds(i));
+            segments[i].end = static_cast<float>(transcript.EndSeconds(i));
+            segments[i].speaker = transcript.Segment(i).speaker;
+            segments[i].text = std::string(transcript.Text(i));
+        }
+        WriteCombinedTranscript(file, segments, static_cast<std::time_t>(transcript.GeneratedAt()), std::string(transcript.ModelTier()));
+    }
+    if (!file) {
+        std::cerr << "Error: Failed to write " << output.string() << std::endl;
+        return 1;
+    }
+    
+    std::cout << "Converted " << transcript.Size() << " segments to " << output.string() << " in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+              << " ms" << std::endl;
+    return 0;
+}
+
+// Writes the transcript (and embedding sidecar) of a processed recording set
+void ExportRecordingSet(const RecordingSetResult& result, const TranscribeOptions& options) {
+    StageTimer timer(result.recordingStats.get(), "export");
+    std::time_t generated = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    ExportCombinedTranscript(result.segments, result.transcriptFilename, options.modelTier, generated);
+    if (options.saveBinary) {
+        ExportBinaryTranscript(result.segments, BinaryTranscriptFilename(result.transcriptFilename), options.modelTier, generated);
+    }
+    if (options.saveEmbeddings) {
+        WriteEmbeddingSidecar(result.sidecar, SidecarFilename(result.transcriptFilename));
+    }
+    // A failed track's journal is what lets the next run resume it
+    if (result.failedFiles == 0) {
+        RemoveJournals(result.journalFiles);
+    }
+}
+
+// Prints the stage breakdown of every file and of the whole set, and writes it as JSON if asked
+void ReportStageStats(const RecordingSetResult& result, const std::string& jsonPath) {
+    StageStats total("total");
+    for (const auto& stats : result.fileStats) {
+        stats->PrintTable();
+        total.Merge(*stats);
+    }
+    total.Merge(*result.recordingStats);
+    total.PrintTable();
+    double rtf = total.AudioSeconds() > 0.0 ? result.wallSeconds / total.AudioSeconds() : 0.0;
+    std::cout << std::fixed << std::setprecision(1) << "End to end: " << result.wallSeconds << " s for " << total.AudioSeconds()
+              << " s of audio, RTF " << std::setprecision(4) << rtf << std::defaultfloat << std::setprecision(6) << std::endl;
+    
+    if (jsonPath.empty()) {
+        return;
+    }
+    std::ofstream file(jsonPath);
+    if (!file.is_open()) {
+        std::cerr << "Error: Failed to create stats file: " << jsonPath << std::endl;
+        return;
+    }
+    file << "{" << std::endl;
+    file << "  \"files\": [" << std::endl;
+    for (size_t i = 0; i < result.fileStats.size(); ++i) {
+        result.fileStats[i]->WriteJson(file, "    ");
+        file << (i + 1 < result.fileStats.size() ? "," : "") << std::endl;
+    }
+    file << "  ]," << std::endl;
+    file << "  \"recording\": " << std::endl;
+    result.recordingStats->WriteJson(file, "  ");
+    file << "," << std::endl;
+    file << "  \"total\": " << std::endl;
+    total.WriteJson(file, "  ");
+    file << "," << std::endl;
+    file << std::fixed << std::setprecision(3) << "  \"end_to_end\": {\"wall_seconds\": " << result.wallSeconds
+         << ", \"audio_seconds\": " << total.AudioSeconds() << ", \"rtf\": " << std::setprecision(6) << rtf << "}" << std::endl;
+    file << "}" << std::endl;
+}
+
+#ifdef _WIN32
+using SocketHandle = SOCKET;
+const SocketHandle kInvalidSocket = INVALID_SOCKET;
+#else
+using SocketHandle = int;
+const SocketHandle kInvalidSocket = -1;
+#endif
+
+void CloseSocket(SocketHandle sock) {
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+}
+
+// Winsock must be initialized once per process before any socket call
+class SocketLibrary {
+public:
+    SocketLibrary() {
+#ifdef _WIN32
+        WSADATA wsaData;
+        WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+    }
+    
+    ~SocketLibrary() {
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+};
+
+bool SendAll(SocketHandle sock, const char* data, size_t length) {
+    while (length > 0) {
+        int chunk = static_cast<int>(std::min<size_t>(length, 1 << 20));
+#ifdef MSG_NOSIGNAL
+        int sent = send(sock, data, chunk, MSG_NOSIGNAL);
+#else
+        int sent = send(sock, data, chunk, 0);
+#endif
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+bool ReceiveAll(SocketHandle sock, char* data, size_t length) {
+    while (length > 0) {
+        int chunk = static_cast<int>(std::min<size_t>(length, 1 << 20));
+        int received = recv(sock, data, chunk, 0);
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        length -= received;
+    }
+    return true;
+}
+
+bool SendFrame(SocketHandle sock, MessageType type, const std::string& payload) {
+    MessageWriter header;
+    header.PutU32(static_cast<uint32_t>(payload.size()));
+    std::string frame = header.Data();
+    frame.push_back(static_cast<char>(type));
+    frame += payload;
+    return SendAll(sock, frame.data(), frame.size());
+}
+
+bool ReceiveFrame(SocketHandle sock, MessageType& type, std::string& payload) {
+    char header[5];
+    if (!ReceiveAll(sock, header, sizeof(header))) {
+        return false;
+    }
+    
+    std::string lengthField(header, 4);
+    MessageReader reader(lengthField);
+    uint32_t length = reader.GetU32();
+    if (length > kMaxFrameSize) {
+        std::cerr << "Error: Oversized frame (" << length << " bytes)" << std::endl;
+        return false;
+    }
+    
+    type = static_cast<MessageType>(header[4]);
+    payload.resize(length);
+    return length == 0 || ReceiveAll(sock, &payload[0], length);
+}
+
+bool MakeSocketAddress(const std::string& path, sockaddr_un& address) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Error: Socket path too long: " << path << std::endl;
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+// True if the process at the other end of a local socket runs as this user. Windows has no
+// peer credentials for AF_UNIX sockets; there the socket's directory is private to the user.
+bool PeerIsCurrentUser(SocketHandle sock) {
+#if defined(_WIN32)
+    (void)sock;
+    return true;
+#elif defined(__linux__)
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    return getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0 && credentials.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(sock, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+#ifndef _WIN32
+// Creates the socket's directory, private to this user, if it does not exist yet. An existing
+// directory must belong to this user or to root (e.g. /tmp), so nobody else can swap the socket.
+bool PrepareSocketDirectory(const std::string& socketPath) {
+    std::filesystem::path directory = std::filesystem::path(socketPath).parent_path();
+    if (directory.empty()) {
+        directory = ".";
+    }
+    if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST) {
+        std::cerr << "Error: Failed to create socket directory: " << directory.string() << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (lstat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || (info.st_uid != getuid() && info.st_uid != 0)) {
+        std::cerr << "Error: Socket directory does not belong to this user: " << directory.string() << std::endl;
+        return false;
+    }
+    return true;
+}
+#endif
+
+// Connects to the daemon listening on path. A daemon run by another user is ignored, since it
+// would read this user's recordings and write transcripts on their behalf.
+SocketHandle ConnectToDaemon(const std::string& path) {
+    sockaddr_un address;
+    if (!MakeSocketAddress(path, address)) {
+        return kInvalidSocket;
+    }
+    
+    SocketHandle sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == kInvalidSocket) {
+        return kInvalidSocket;
+    }
+    
+    if (connect(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        CloseSocket(sock);
+        return kInvalidSocket;
+    }
+    if (!PeerIsCurrentUser(sock)) {
+        std::cerr << "Warning: Ignoring a transcription daemon run by another user on " << path << std::endl;
+        CloseSocket(sock);
+        return kInvalidSocket;
+    }
+    return sock;
+}
+
+// Total length of a job's audio files, in seconds; unreadable files count as empty
+double JobAudioSeconds(const std::vector<std::string>& files) {
+    double seconds = 0.0;
+    for (const auto& file : files) {
+        WavReader wav;
+        if (wav.Open(file)) {
+            seconds += wav.Seconds();
+        }
+    }
+    return seconds;
+}
+
+// Chooses the ASR model tier of each job of the daemon or of --watch from the backlog. Tiers
+// are listed best (and slowest) first. A job gets the best tier that is expected to finish
+// all queued and running audio within the target latency, given the real-time factor each
+// tier has shown on earlier jobs. A tier that has not run yet is assumed to be twice as fast
+// as the tier before it (and half as fast as the one after it).
+class TierSelector {
+private:
+    std::vector<std::string> tiers;
+    double targetSeconds;
+    int workers;
+    std::mutex mutex;
+    double backlogSeconds = 0.0;  // Audio of the jobs that are queued or running
+    int backlogJobs = 0;
+    std::vector<double> observedRtf;  // Smoothed wall time per audio second; 0 = not observed yet
+    
+    double EstimatedRtf(size_t tier) const {
+        if (observedRtf[tier] > 0.0) {
+            return observedRtf[tier];
+        }
+        for (size_t distance = 1; distance < tiers.size(); ++distance) {
+            if (tier >= distance && observedRtf[tier - distance] > 0.0) {
+                return observedRtf[tier - distance] / std::pow(2.0, static_cast<double>(distance));
+            }
+            if (tier + distance < tiers.size() && observedRtf[tier + distance] > 0.0) {
+                return observedRtf[tier + distance] * std::pow(2.0, static_cast<double>(distance));
+            }
+        }
+        // Nothing has run yet: Moonshine base int8 runs well under a tenth of real time
+        return 0.1 / std::pow(2.0, static_cast<double>(tier));
+    }
+    
+public:
+    TierSelector(const std::vector<std::string>& modelTiers, float targetLatencyMinutes, int maxJobs)
+        : tiers(modelTiers), targetSeconds(targetLatencyMinutes * 60.0), workers(std::max(1, maxJobs)),
+          observedRtf(modelTiers.size(), 0.0) {}
+    
+    // With a single tier or no target there is nothing to choose
+    bool Adaptive() const {
+        return tiers.size() > 1 && targetSeconds > 0.0;
+    }
+    
+    bool Configured() const {
+        return !tiers.empty();
+    }
+    
+    const std::string& Tier(size_t tier) const {
+        return tiers[tier];
+    }
+    
+    // A job entered the backlog
+    void Add(double audioSeconds) {
+        std::lock_guard<std::mutex> lock(mutex);
+        backlogSeconds += audioSeconds;
+        ++backlogJobs;
+    }
+    
+    // Tier for a job that is starting now, and a line describing the choice for the transcript header
+    size_t Select(std::string& description) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t chosen = 0;
+        double drainSeconds = 0.0;
+        for (size_t tier = 0; tier < tiers.size(); ++tier) {
+            chosen = tier;
+            drainSeconds = backlogSeconds * EstimatedRtf(tier) / workers;
+            if (!Adaptive() || drainSeconds <= targetSeconds) {
+                break;
+            }
+        }
+        
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(2) << (chosen + 1) << "/" << tiers.size() << " " << tiers[chosen];
+        if (Adaptive()) {
+            line << " (backlog " << backlogJobs << " job(s), " << backlogSeconds / 60.0 << " min of audio, expected to finish in "
+                 << drainSeconds / 60.0 << " min, target " << targetSeconds / 60.0 << " min)";
+        }
+        description = line.str();
+        return chosen;
+    }
+    
+    // A job left the backlog; its speed updates the estimate for its tier unless it never ran
+    void Finish(size_t tier, double audioSeconds, double wallSeconds) {
+        std::lock_guard<std::mutex> lock(mutex);
+        backlogSeconds = std::max(0.0, backlogSeconds - audioSeconds);
+        --backlogJobs;
+        if (audioSeconds < 1.0 || wallSeconds <= 0.0) {
+            return;
+        }
+        double rtf = wallSeconds / audioSeconds;
+        observedRtf[tier] = observedRtf[tier] > 0.0 ? 0.7 * observedRtf[tier] + 0.3 * rtf : rtf;
+    }
+};
+
+// Counting semaphore bounding the number of jobs that run at once
+class JobSlots {
+private:
+    std::mutex mutex;
+    std::condition_variable available;
+    int freeSlots;
+    
+public:
+    explicit JobSlots(int count) : freeSlots(count) {}
+    
+    void Acquire() {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this] { return freeSlots > 0; });
+        --freeSlots;
+    }
+    
+    void Release() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++freeSlots;
+        }
+        available.notify_one();
+    }
+};
+
+// The first option set that configures a whole process (the daemon, a watcher, a benchmark,
+// model loading) rather than one job; empty if there is none. The daemon rejects jobs with one.
+std::string ProcessOnlyOption(const TranscribeOptions& options) {
+    if (options.serve) return "--serve";
+    if (!options.watchDirectory.empty()) return "--watch";
+    if (!options.reclusterFile.empty()) return "--recluster";
+    if (!options.convertFile.empty()) return "--convert";
+    if (!options.benchDecodeFile.empty()) return "--bench-decode";
+    if (!options.benchVadFiles.empty()) return "--bench-vad";
+    if (options.warmUp) return "--warm-up";
+    if (!options.optimizedModelCache) return "--no-model-cache";
+    if (!options.modelTiers.empty()) return "--model-tiers";
+    if (options.targetLatencyMinutes > 0.0f) return "--target-latency";
+    return "";
+}
+
+// Jobs the daemon keeps waiting for a slot; connections beyond that are turned away
+const int kMaxQueuedJobs = 32;
+
+// True if accept() failed for a reason that does not break the listening socket
+bool AcceptErrorIsTransient() {
+#ifdef _WIN32
+    int error = WSAGetLastError();
+    return error == WSAECONNRESET || error == WSAEINTR || error == WSAEMFILE || error == WSAENOBUFS;
+#else
+    return errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM;
+#endif
+}
+
+class TranscriptionServer {
+private:
+    // Thread serving one client; the accept loop joins it once it has finished
+    struct Connection {
+        std::thread thread;
+        std::atomic<bool> finished{false};
+    };
+    
+    TranscriptionEngine& engine;
+    std::string socketPath;
+    JobSlots slots;
+    TierSelector tiers;
+    size_t maxConnections;
+    std::list<std::unique_ptr<Connection>> connections;
+    
+    void JoinFinishedConnections() {
+        for (auto it = connections.begin(); it != connections.end();) {
+            if ((*it)->finished) {
+                (*it)->thread.join();
+                it = connections.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+public:
+    TranscriptionServer(TranscriptionEngine& transcriptionEngine, const std::string& path, const TranscribeOptions& options)
+        : engine(transcriptionEngine), socketPath(path), slots(options.maxJobs),
+          tiers(options.modelTiers, options.targetLatencyMinutes, options.maxJobs),
+          maxConnections(static_cast<size_t>(options.maxJobs + kMaxQueuedJobs)) {}
+    
+    ~TranscriptionServer() {
+        for (auto& connection : connections) {
+            connection->thread.join();
+        }
+    }
+    
+    int Run() {
+        // Refuse to steal the socket from a daemon that is still alive
+        SocketHandle existing = ConnectToDaemon(socketPath);
+        if (existing != kInvalidSocket) {
+            CloseSocket(existing);
+            std::cerr << "Error: A transcription daemon is already listening on " << socketPath << std::endl;
+            return 1;
+        }
+        
+#ifndef _WIN32
+        if (!PrepareSocketDirectory(socketPath)) {
+            return 1;
+        }
+#endif
+
+        // Remove a stale socket file left behind by a daemon that did not exit cleanly
+        std::error_code ec;
+        std::filesystem::remove(socketPath, ec);
+        
+        sockaddr_un address;
+        if (!MakeSocketAddress(socketPath, address)) {
+            return 1;
+        }
+        
+        SocketHandle listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener == kInvalidSocket) {
+            std::cerr << "Error: Failed to create socket" << std::endl;
+            return 1;
+        }
+        
+        if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(listener, 16) != 0) {
+            std::cerr << "Error: Failed to listen on " << socketPath << std::endl;
+            CloseSocket(listener);
+            return 1;
+        }
+#ifndef _WIN32
+        // Only this user may connect; peers are checked as well, for directories others can read
+        if (chmod(socketPath.c_str(), 0600) != 0) {
+            std::cerr << "Error: Failed to restrict access to " << socketPath << std::endl;
+            CloseSocket(listener);
+            return 1;
+        }
+#endif
+
+        std::cout << "Transcription daemon listening on " << socketPath << std::endl;
+        
+        while (true) {
+            SocketHandle client = accept(listener, nullptr, nullptr);
+            if (client == kInvalidSocket) {
+                if (!AcceptErrorIsTransient()) {
+                    std::cerr << "Error: accept() failed, the daemon stops once its jobs are done" << std::endl;
+                    break;
+                }
+                std::cerr << "Warning: accept() failed" << std::endl;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            if (!PeerIsCurrentUser(client)) {
+                std::cerr << "Warning: Rejecting a connection from another user" << std::endl;
+                CloseSocket(client);
+                continue;
+            }
+            
+            // Each connection waits for a job slot on its own thread, so their number is capped
+            JoinFinishedConnections();
+            if (connections.size() >= maxConnections) {
+                MessageWriter message;
+                message.PutString("The daemon has too many jobs queued, try again later");
+                SendFrame(client, MessageType::Error, message.Data());
+                CloseSocket(client);
+                continue;
+            }
+            auto connection = std::make_unique<Connection>();
+            Connection* started = connection.get();
+            started->thread = std::thread([this, started, client] {
+                HandleConnection(client);
+                started->finished = true;
+            });
+            connections.push_back(std::move(connection));
+        }
+        
+        CloseSocket(listener);
+        for (auto& connection : connections) {
+            connection->thread.join();
+        }
+        connections.clear();
+        std::error_code removeError;
+        std::filesystem::remove(socketPath, removeError);
+        return 1;
+    }
+    
+private:
+    void HandleConnection(SocketHandle client) {
+        MessageType type;
+        std::string payload;
+        if (!ReceiveFrame(client, type, payload) || type != MessageType::JobRequest) {
+            std::cerr << "Warning: Dropping connection without a job request" << std::endl;
+            CloseSocket(client);
+            return;
+        }
+        
+        MessageReader reader(payload);
+        uint32_t version = reader.GetU32();
+        std::string workingDirectory = reader.GetString();
+        uint32_t argCount = reader.GetU32();
+        std::vector<std::string> args;
+        for (uint32_t i = 0; i < argCount && reader.Ok(); ++i) {
+            args.push_back(reader.GetString());
+        }
+        
+        TranscribeOptions jobOptions;
+        std::string error;
+        if (!reader.Ok() || version != kProtocolVersion) {
+            error = "Malformed job request or protocol version mismatch";
+        } else if (!ParseArguments(args, jobOptions, error)) {
+            // error already set
+        } else if (!ProcessOnlyOption(jobOptions).empty()) {
+            error = ProcessOnlyOption(jobOptions) + " configures the daemon itself and cannot be used in a job";
+        } else if (jobOptions.inputFiles.empty()) {
+            error = "No input files";
+        }
+        
+        if (!error.empty()) {
+            MessageWriter message;
+            message.PutString(error);
+            SendFrame(client, MessageType::Error, message.Data());
+            CloseSocket(client);
+            return;
+        }
+        
+        // Resolve paths against the client's working directory
+        for (auto& file : jobOptions.inputFiles) {
+            std::filesystem::path path(file);
+            if (path.is_relative()) {
+                file = (std::filesystem::path(workingDirectory) / path).string();
+            }
+        }
+        jobOptions.outputDirectory = workingDirectory;
+        if (!jobOptions.cacheDirectory.empty() && std::filesystem::path(jobOptions.cacheDirectory).is_relative()) {
+            jobOptions.cacheDirectory = (std::filesystem::path(workingDirectory) / jobOptions.cacheDirectory).string();
+        }
+        if (!jobOptions.statsJsonPath.empty() && std::filesystem::path(jobOptions.statsJsonPath).is_relative()) {
+            jobOptions.statsJsonPath = (std::filesystem::path(workingDirectory) / jobOptions.statsJsonPath).string();
+        }
+        if (!jobOptions.startupJsonPath.empty() && std::filesystem::path(jobOptions.startupJsonPath).is_relative()) {
+            jobOptions.startupJsonPath = (std::filesystem::path(workingDirectory) / jobOptions.startupJsonPath).string();
+        }
+        
+        MessageWriter queued;
+        queued.PutString("Job queued");
+        SendFrame(client, MessageType::Status, queued.Data());
+        
+        double audioSeconds = tiers.Configured() ? JobAudioSeconds(jobOptions.inputFiles) : 0.0;
+        if (tiers.Configured()) {
+            tiers.Add(audioSeconds);
+        }
+        
+        slots.Acquire();
+        
+        size_t tier = 0;
+        if (tiers.Configured()) {
+            tier = tiers.Select(jobOptions.modelTier);
+            jobOptions.decode.asrModel = tiers.Tier(tier);
+        }
+        
+        MessageWriter started;
+        started.PutString(jobOptions.modelTier.empty() ? "Job started" : "Job started, model tier " + jobOptions.modelTier);
+        SendFrame(client, MessageType::Status, started.Data());
+        
+        // Segments are streamed back as soon as they are decoded; a client that went
+        // away does not abort the job, its transcript is still written.
+        std::mutex sendMutex;
+        RecordingSetResult result = ProcessRecordingSet(engine, jobOptions,
+            [client, &sendMutex](const SpeakerSegment& segment) {
+                MessageWriter message;
+                message.PutF32(segment.start);
+                message.PutF32(segment.end);
+                message.PutI32(segment.speaker);
+                message.PutString(segment.text);
+                std::lock_guard<std::mutex> lock(sendMutex);
+                SendFrame(client, MessageType::Segment, message.Data());
+            });
+        
+        // As in --watch, a failed job writes no transcript and keeps its journals for a retry
+        if (result.failedFiles == 0 && !result.segments.empty() && !result.transcriptFilename.empty()) {
+            ExportRecordingSet(result, jobOptions);
+        }
+        ReportStageStats(result, jobOptions.statsJsonPath);
+        
+        if (tiers.Configured()) {
+            tiers.Finish(tier, audioSeconds, result.wallSeconds);
+        }
+        slots.Release();
+        
+        if (!jobOptions.startupJsonPath.empty()) {
+            engine.WriteStartupJson(jobOptions.startupJsonPath);
+        }
+        
+        if (result.failedFiles > 0) {
+            MessageWriter failed;
+            failed.PutString("Job failed: " + std::to_string(result.failedFiles) + " of " + std::to_string(jobOptions.inputFiles.size()) +
+                             " track(s) could not be transcribed");
+            SendFrame(client, MessageType::Error, failed.Data());
+            CloseSocket(client);
+            return;
+        }
+        
+        MessageWriter done;
+        done.PutString(result.segments.empty() ? "" : result.transcriptFilename);
+        done.PutU32(static_cast<uint32_t>(result.segments.size()));
+        SendFrame(client, MessageType::Done, done.Data());
+        CloseSocket(client);
+    }
+};
+
+// State of a recording in the --watch job queue
+enum class JobState {
+    Pending,
+    Running,
+    Done,
+    Failed
+};
+
+const char* JobStateName(JobState state) {
+    switch (state) {
+        case JobState::Pending: return "pending";
+        case JobState::Running: return "running";
+        case JobState::Done: return "done";
+        case JobState::Failed: return "failed";
+    }
+    return "pending";
+}
+
+bool ParseJobState(const std::string& name, JobState& state) {
+    for (JobState candidate : {JobState::Pending, JobState::Running, JobState::Done, JobState::Failed}) {
+        if (name == JobStateName(candidate)) {
+            state = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct WatchJob {
+    std::string key;                 // Recording name shared by its tracks, e.g. recording_20250912_152706
+    std::vector<std::string> files;  // Track file names within the watched directory, microphone first
+    JobState state = JobState::Pending;
+    int64_t recordedAt = 0;          // Modification time of the newest track; orders the queue
+    int attempts = 0;
+};
+
+// Recording a track belongs to: its file stem without the _microphone or _system suffix
+std::string RecordingKey(const std::filesystem::path& file) {
+    std::string stem = file.stem().string();
+    for (const char* suffix : {"_microphone", "_system"}) {
+        size_t pos = stem.rfind(suffix);
+        if (pos != std::string::npos && pos + std::strlen(suffix) == stem.size()) {
+            return stem.substr(0, pos);
+        }
+    }
+    return stem;
+}
+
+// Jobs of a watched directory, kept in a text file next to the recordings so that a restarted
+// watcher neither repeats finished recordings nor forgets queued ones. Every change rewrites
+// the file through a temporary file and a rename, so a crash leaves the old or the new queue.
+class JobQueue {
+private:
+    std::filesystem::path path;
+    std::map<std::string, WatchJob> jobs;
+    
+public:
+    explicit JobQueue(const std::filesystem::path& queuePath) : path(queuePath) {}
+    
+    // Reads the queue left by a previous run; jobs it was running when it stopped are pending again.
+    // Returns the number of such interrupted jobs.
+    int Load() {
+        int interrupted = 0;
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            // state, recorded-at, attempts, key, then one field per track
+            std::vector<std::string> fields;
+            std::istringstream stream(line);
+            std::string field;
+            while (std::getline(stream, field, '\t')) {
+                fields.push_back(field);
+            }
+            WatchJob job;
+            if (fields.size() < 5 || !ParseJobState(fields[0], job.state)) {
+                std::cerr << "Warning: Ignoring malformed line in " << path.string() << ": " << line << std::endl;
+                continue;
+            }
+            job.recordedAt = std::atoll(fields[1].c_str());
+            job.attempts = std::atoi(fields[2].c_str());
+            job.key = fields[3];
+            job.files.assign(fields.begin() + 4, fields.end());
+            if (job.state == JobState::Running) {
+                job.state = JobState::Pending;
+                ++interrupted;
+            }
+            jobs[job.key] = job;
+        }
+        return interrupted;
+    }
+    
+    bool Save() const {
+        std::filesystem::path temporary = path;
+        temporary += ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::trunc);
+            if (!file.is_open()) {
+                std::cerr << "Error: Failed to write job queue: " << temporary.string() << std::endl;
+                return false;
+            }
+            file << "# state\trecorded_at\tattempts\trecording\ttracks..." << std::endl;
+            for (const auto& entry : jobs) {
+                const WatchJob& job = entry.second;
+                file << JobStateName(job.state) << '\t' << job.recordedAt << '\t' << job.attempts << '\t' << job.key;
+                for (const auto& track : job.files) {
+                    file << '\t' << track;
+                }
+                file << '\n';
+            }
+            if (!file.flush()) {
+                std::cerr << "Error: Failed to write job queue: " << temporary.string() << std::endl;
+                return false;
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(temporary, path, ec);
+        if (ec) {
+            std::cerr << "Error: Failed to replace job queue " << path.string() << ": " << ec.message() << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    WatchJob* Find(const std::string& key) {
+        auto it = jobs.find(key);
+        return it == jobs.end() ? nullptr : &it->second;
+    }
+    
+    void Add(const WatchJob& job) {
+        jobs[job.key] = job;
+    }
+    
+    // The pending job to run next: the newest or the oldest recording
+    WatchJob* Next(bool newestFirst) {
+        WatchJob* best = nullptr;
+        for (auto& entry : jobs) {
+            WatchJob& job = entry.second;
+            if (job.state != JobState::Pending) {
+                continue;
+            }
+            if (!best || (newestFirst ? job.recordedAt > best->recordedAt : job.recordedAt < best->recordedAt)) {
+                best = &job;
+            }
+        }
+        return best;
+    }
+    
+    int Count(JobState state) const {
+        int count = 0;
+        for (const auto& entry : jobs) {
+            count += entry.second.state == state ? 1 : 0;
+        }
+        return count;
+    }
+    
+    std::vector<WatchJob> Jobs(JobState state) const {
+        std::vector<WatchJob> matching;
+        for (const auto& entry : jobs) {
+            if (entry.second.state == state) {
+                matching.push_back(entry.second);
+            }
+        }
+        return matching;
+    }
 };
 
-class TranscriptionEngine {
+// Exclusive lock on a watched directory, so two watchers never work on the same recordings.
+// The OS drops the lock when the process exits, however it exits.
+class DirectoryLock {
 private:
-    const SherpaOnnxOfflineRecognizer* recognizer;
-    const SherpaOnnxVoiceActivityDetector* vad;
-    const SherpaOnnxOfflineSpeakerDiarization* diarization;
-    std::string modelPath;
-    std::string vadModelPath;
-    std::string segmentationModelPath;
-    std::string embeddingModelPath;
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
     
 public:
-    TranscriptionEngine(const std::string& modelDir, const std::string& vadModelFile, 
-                       const std::string& segmentationModel, const std::string& embeddingModel) 
-        : recognizer(nullptr), vad(nullptr), diarization(nullptr), 
-          modelPath(modelDir), vadModelPath(vadModelFile), 
-          segmentationModelPath(segmentationModel), embeddingModelPath(embeddingModel) {
-        Initialize();
+    ~DirectoryLock() {
+#ifdef _WIN32
+        if (handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(handle);
+        }
+#else
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
     }
     
-    ~TranscriptionEngine() {
-        if (recognizer) {
-            SherpaOnnxDestroyOfflineRecognizer(recognizer);
-        }
-        if (vad) {
-            SherpaOnnxDestroyVoiceActivityDetector(vad);
+    bool Acquire(const std::filesystem::path& path) {
+#ifdef _WIN32
+        handle = CreateFileW(path.wstring().c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS,
+                             FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+        return handle != INVALID_HANDLE_VALUE;
+#else
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        return fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) == 0;
+#endif
+    }
+};
+
+// Blocks until something in a directory changes or a timeout passes: inotify on Linux,
+// change notifications on Windows and plain polling elsewhere. Callers rescan the
+// directory after every wake-up, so which file changed does not matter.
+class DirectoryChanges {
+private:
+#if defined(_WIN32)
+    HANDLE handle = INVALID_HANDLE_VALUE;
+#elif defined(__linux__)
+    int fd = -1;
+#endif
+    
+public:
+    ~DirectoryChanges() {
+#if defined(_WIN32)
+        if (handle != INVALID_HANDLE_VALUE) {
+            FindCloseChangeNotification(handle);
         }
-        if (diarization) {
-            SherpaOnnxDestroyOfflineSpeakerDiarization(diarization);
+#elif defined(__linux__)
+        if (fd >= 0) {
+            close(fd);
         }
+#endif
     }
     
-    bool Initialize() {
-        // Check if model files exist
-        std::string preprocessor = modelPath + "/preprocess.onnx";
-        std::string encoder = modelPath + "/encode.int8.onnx";
-        std::string uncached_decoder = modelPath + "/uncached_decode.int8.onnx";
-        std::string cached_decoder = modelPath + "/cached_decode.int8.onnx";
-        std::string tokens = modelPath + "/tokens.txt";
-        
-        if (!std::filesystem::exists(preprocessor) || 
-            !std::filesystem::exists(encoder) || 
-            !std::filesystem::exists(uncached_decoder) || 
-            !std::filesystem::exists(cached_decoder) || 
-            !std::filesystem::exists(tokens)) {
-            std::cerr << "Error: Required model files not found in " << modelPath << std::endl;
-            return false;
+    bool Open(const std::filesystem::path& directory) {
+#if defined(_WIN32)
+        handle = FindFirstChangeNotificationW(directory.wstring().c_str(), FALSE,
+                                              FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+        return handle != INVALID_HANDLE_VALUE;
+#elif defined(__linux__)
+        // A finished recording is closed after writing or moved in from elsewhere
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        return fd >= 0 && inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) >= 0;
+#else
+        return true;
+#endif
+    }
+    
+    void Wait(int timeoutMs) {
+#if defined(_WIN32)
+        if (WaitForSingleObject(handle, static_cast<DWORD>(timeoutMs)) == WAIT_OBJECT_0) {
+            FindNextChangeNotification(handle);
         }
-        
-        if (!std::filesystem::exists(vadModelPath)) {
-            std::cerr << "Error: VAD model file not found: " << vadModelPath << std::endl;
-            return false;
+#elif defined(__linux__)
+        pollfd descriptor = {fd, POLLIN, 0};
+        if (poll(&descriptor, 1, timeoutMs) > 0) {
+            char events[4096];
+            while (read(fd, events, sizeof(events)) > 0) {
+            }
         }
-        
-        if (!std::filesystem::exists(segmentationModelPath)) {
-            std::cerr << "Error: Segmentation model file not found: " << segmentationModelPath << std::endl;
-            return false;
+#else
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+#endif
+    }
+};
+
+// --watch mode: turns every completed recording that appears in a directory into a job,
+// runs the jobs on a pool of --max-jobs workers with the models kept resident, and records
+// each job's state in the directory so restarts resume where the last run stopped.
+class DirectoryWatcher {
+private:
+    TranscriptionEngine& engine;
+    TranscribeOptions options;
+    std::filesystem::path directory;
+    JobQueue queue;
+    std::mutex mutex;
+    std::condition_variable jobsAvailable;
+    TierSelector tiers;
+    
+public:
+    DirectoryWatcher(TranscriptionEngine& transcriptionEngine, const TranscribeOptions& watchOptions)
+        : engine(transcriptionEngine), options(watchOptions), directory(watchOptions.watchDirectory),
+          queue(std::filesystem::path(watchOptions.watchDirectory) / ".transcribe_queue"),
+          tiers(watchOptions.modelTiers, watchOptions.targetLatencyMinutes, watchOptions.maxJobs) {}
+    
+    int Run() {
+        std::error_code ec;
+        if (!std::filesystem::is_directory(directory, ec)) {
+            std::cerr << "Error: --watch needs an existing directory: " << directory.string() << std::endl;
+            return 1;
         }
         
-        if (!std::filesystem::exists(embeddingModelPath)) {
-            std::cerr << "Error: Embedding model file not found: " << embeddingModelPath << std::endl;
-            return false;
+        DirectoryLock lock;
+        if (!lock.Acquire(directory / ".transcribe_queue.lock")) {
+            std::cerr << "Error: Another transcribe --watch is already working on " << directory.string() << std::endl;
+            return 1;
         }
         
-        // Configure offline model
-        SherpaOnnxOfflineModelConfig offline_model_config;
-        memset(&offline_model_config, 0, sizeof(offline_model_config));
-        offline_model_config.debug = 0;  // Set to 1 for debug output
-        offline_model_config.num_threads = 1;
-        offline_model_config.provider = "cpu";
-        offline_model_config.tokens = tokens.c_str();
-        offline_model_config.moonshine.preprocessor = preprocessor.c_str();
-        offline_model_config.moonshine.encoder = encoder.c_str();
-        offline_model_config.moonshine.uncached_decoder = uncached_decoder.c_str();
-        offline_model_config.moonshine.cached_decoder = cached_decoder.c_str();
-        
-        // Configure recognizer
-        SherpaOnnxOfflineRecognizerConfig recognizer_config;
-        memset(&recognizer_config, 0, sizeof(recognizer_config));
-        recognizer_config.decoding_method = "greedy_search";
-        recognizer_config.model_config = offline_model_config;
-        
-        // Create recognizer
-        recognizer = SherpaOnnxCreateOfflineRecognizer(&recognizer_config);
-        
-        if (recognizer == nullptr) {
-            std::cerr << "Error: Failed to create recognizer. Please check your model configuration." << std::endl;
-            return false;
+        DirectoryChanges changes;
+        if (!changes.Open(directory)) {
+            std::cerr << "Error: Failed to watch " << directory.string() << " for changes" << std::endl;
+            return 1;
         }
         
-        // Configure VAD
-        SherpaOnnxVadModelConfig vadConfig;
-        memset(&vadConfig, 0, sizeof(vadConfig));
-        vadConfig.silero_vad.model = vadModelPath.c_str();
-        vadConfig.silero_vad.threshold = 0.25f;
-        vadConfig.silero_vad.min_silence_duration = 0.5f;
-        vadConfig.silero_vad.min_speech_duration = 0.5f;
-        vadConfig.silero_vad.max_speech_duration = 10.0f;
-        vadConfig.silero_vad.window_size = 512;
-        vadConfig.sample_rate = 16000;
-        vadConfig.num_threads = 1;
-        vadConfig.debug = 0;
-        
-        vad = SherpaOnnxCreateVoiceActivityDetector(&vadConfig, 30);
-        
-        if (vad == nullptr) {
-            std::cerr << "Error: Failed to create VAD" << std::endl;
-            return false;
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            int interrupted = queue.Load();
+            queue.Save();
+            if (tiers.Configured()) {
+                for (const auto& job : queue.Jobs(JobState::Pending)) {
+                    tiers.Add(AudioSeconds(job));
+                }
+            }
+            std::cout << "Watching " << directory.string() << " (" << queue.Count(JobState::Pending) << " pending, "
+                      << queue.Count(JobState::Done) << " done, " << queue.Count(JobState::Failed) << " failed";
+            if (interrupted > 0) {
+                std::cout << ", " << interrupted << " interrupted job(s) requeued";
+            }
+            std::cout << ")" << std::endl;
         }
         
-        // Configure speaker diarization
-        SherpaOnnxOfflineSpeakerDiarizationConfig diarizationConfig;
-        memset(&diarizationConfig, 0, sizeof(diarizationConfig));
-        diarizationConfig.segmentation.pyannote.model = segmentationModelPath.c_str();
-        diarizationConfig.embedding.model = embeddingModelPath.c_str();
-        diarizationConfig.clustering.threshold = 0.5f; // Use threshold instead of fixed number of speakers
-        
-        diarization = SherpaOnnxCreateOfflineSpeakerDiarization(&diarizationConfig);
-        
-        if (diarization == nullptr) {
-            std::cerr << "Error: Failed to create speaker diarization" << std::endl;
-            return false;
+        for (int i = 0; i < options.maxJobs; ++i) {
+            std::thread(&DirectoryWatcher::Work, this).detach();
         }
         
-        std::cout << "Transcription engine with VAD and Speaker Diarization initialized successfully" << std::endl;
-        std::cout << "ASR Model: " << modelPath << std::endl;
-        std::cout << "VAD Model: " << vadModelPath << std::endl;
-        std::cout << "Segmentation Model: " << segmentationModelPath << std::endl;
-        std::cout << "Embedding Model: " << embeddingModelPath << std::endl;
-        return true;
+        // Rescan on every change; while a recording waits for its other track, also once a second
+        while (true) {
+            bool settling = Scan();
+            changes.Wait(settling ? 1000 : 60000);
+        }
     }
     
-    std::string TranscribeFile(const std::string& wavFile) {
-        if (!recognizer || !vad) {
-            std::cerr << "Error: Transcription engine not initialized" << std::endl;
-            return "";
-        }
+private:
+    // Queues the recordings whose tracks are all finalized. A recording with only one of its
+    // two tracks waits until the settle time has passed since that track was last written.
+    // Returns whether any recording is still waiting.
+    bool Scan() {
+        auto now = std::filesystem::file_time_type::clock::now();
+        auto settle = std::chrono::duration_cast<std::filesystem::file_time_type::duration>(
+            std::chrono::duration<float>(options.watchSettleSeconds));
         
-        if (!std::filesystem::exists(wavFile)) {
-            std::cerr << "Error: Audio file not found: " << wavFile << std::endl;
-            return "";
+        struct Candidate {
+            std::vector<std::string> files;
+            std::filesystem::file_time_type newest = std::filesystem::file_time_type::min();
+            bool complete = true;
+        };
+        std::map<std::string, Candidate> recordings;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+            std::string name = entry.path().filename().string();
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+            if (name[0] == '.' || extension != ".wav" || !entry.is_regular_file(ec)) {
+                continue;
+            }
+            Candidate& candidate = recordings[RecordingKey(entry.path())];
+            candidate.files.push_back(name);
+            candidate.newest = std::max(candidate.newest, entry.last_write_time(ec));
+            candidate.complete = candidate.complete && IsWavFinalized(entry.path().string());
         }
         
-        std::cout << "Transcribing: " << wavFile << std::endl;
-        
-        // Read the WAV file
-        const SherpaOnnxWave* wave = SherpaOnnxReadWave(wavFile.c_str());
-        if (wave == nullptr) {
-            std::cerr << "Error: Failed to read WAV file: " << wavFile << std::endl;
-            return "";
+        bool settling = false;
+        bool queued = false;
+        std::lock_guard<std::mutex> guard(mutex);
+        for (auto& entry : recordings) {
+            Candidate& candidate = entry.second;
+            int64_t recordedAt = static_cast<int64_t>(candidate.newest.time_since_epoch().count());
+            WatchJob* existing = queue.Find(entry.first);
+            // A failed recording is retried once its files are rewritten; anything else is only queued once
+            if (existing && !(existing->state == JobState::Failed && recordedAt > existing->recordedAt)) {
+                continue;
+            }
+            
+            bool paired = false;
+            for (const auto& file : candidate.files) {
+                paired = paired || file.find("_system") != std::string::npos;
+            }
+            paired = paired && candidate.files.size() > 1;
+            if (!candidate.complete || (!paired && now - candidate.newest < settle)) {
+                settling = true;
+                continue;
+            }
+            
+            // Microphone first, which is the order the speaker IDs of a recording are assigned in
+            std::sort(candidate.files.begin(), candidate.files.end(), [](const std::string& a, const std::string& b) {
+                bool aMicrophone = a.find("_microphone") != std::string::npos;
+                bool bMicrophone = b.find("_microphone") != std::string::npos;
+                return aMicrophone != bMicrophone ? aMicrophone : a < b;
+            });
+            WatchJob job;
+            job.key = entry.first;
+            job.files = candidate.files;
+            job.recordedAt = recordedAt;
+            job.attempts = existing ? existing->attempts : 0;
+            queue.Add(job);
+            queued = true;
+            if (tiers.Configured()) {
+                tiers.Add(AudioSeconds(job));
+            }
+            std::cout << "Queued " << job.key << " (" << job.files.size() << " track(s))" << std::endl;
         }
-        
-        // Check sample rate
-        if (wave->sample_rate != 16000) {
-            std::cerr << "Warning: Expected sample rate 16000 Hz, got " << wave->sample_rate << " Hz" << std::endl;
-            SherpaOnnxFreeWave(wave);
-            return "Error: Unsupported sample rate";
+        if (queued) {
+            queue.Save();
+            jobsAvailable.notify_all();
         }
-        
-        std::cout << "Audio info - Sample rate: " << wave->sample_rate << " Hz, Samples: " << wave->num_samples << std::endl;
-        
-        // Process audio with VAD
-        std::vector<std::string> transcriptions;
-        int32_t window_size = 512; // Silero VAD window size
-        int32_t i = 0;
-        int is_eof = 0;
-        
-        auto start_time = std::chrono::high_resolution_clock::now();
-        
-        while (!is_eof) {
-            if (i + window_size < wave->num_samples) {
-                SherpaOnnxVoiceActivityDetectorAcceptWaveform(vad, wave->samples + i, window_size);
-            } else {
-                SherpaOnnxVoiceActivityDetectorFlush(vad);
-                is_eof = 1;
+        return settling;
+    }
+    
+    void Work() {
+        while (true) {
+            WatchJob job;
+            {
+                std::unique_lock<std::mutex> guard(mutex);
+                jobsAvailable.wait(guard, [this] { return queue.Next(options.newestFirst) != nullptr; });
+                WatchJob* next = queue.Next(options.newestFirst);
+                next->state = JobState::Running;
+                ++next->attempts;
+                job = *next;
+                queue.Save();
             }
             
-            while (!SherpaOnnxVoiceActivityDetectorEmpty(vad)) {
-                const SherpaOnnxSpeechSegment* segment = SherpaOnnxVoiceActivityDetectorFront(vad);
-                
-                // Create stream for this segment
-                const SherpaOnnxOfflineStream* stream = SherpaOnnxCreateOfflineStream(recognizer);
-                
-                // Accept waveform for this segment
-                SherpaOnnxAcceptWaveformOffline(stream, wave->sample_rate, segment->samples, segment->n);
-                
-                // Decode
-                SherpaOnnxDecodeOfflineStream(recognizer, stream);
-                
-                // Get result
-                const SherpaOnnxOfflineRecognizerResult* result = SherpaOnnxGetOfflineStreamResult(stream);
-                
-                float start = segment->start / 16000.0f;
-                float duration = segment->n / 16000.0f;
-                float stop = start + duration;
-                
-                std::string segmentText = result ? result->text : "";
-                if (!segmentText.empty()) {
-                    transcriptions.push_back(segmentText);
-                    std::cout << "Speech segment [" << start << "s - " << stop << "s]: " << segmentText << std::endl;
-                }
-                
-                // Cleanup
-                if (result) {
-                    SherpaOnnxDestroyOfflineRecognizerResult(result);
-                }
-                SherpaOnnxDestroyOfflineStream(stream);
-                SherpaOnnxDestroySpeechSegment(segment);
-                SherpaOnnxVoiceActivityDetectorPop(vad);
+            bool succeeded = RunJob(job);
+            
+            std::lock_guard<std::mutex> guard(mutex);
+            if (WatchJob* finished = queue.Find(job.key)) {
+                finished->state = succeeded ? JobState::Done : JobState::Failed;
+                queue.Save();
             }
-            i += window_size;
         }
-        
-        auto end_time = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-        
-        // Combine all transcriptions
-        std::string fullTranscription;
-        for (size_t j = 0; j < transcriptions.size(); ++j) {
-            if (j > 0) {
-                fullTranscription += " ";
+    }
+    
+    double AudioSeconds(const WatchJob& job) const {
+        std::vector<std::string> paths;
+        for (const auto& track : job.files) {
+            paths.push_back((directory / track).string());
+        }
+        return JobAudioSeconds(paths);
+    }
+    
+    bool RunJob(const WatchJob& job) {
+        TranscribeOptions jobOptions = options;
+        size_t tier = 0;
+        if (tiers.Configured()) {
+            tier = tiers.Select(jobOptions.modelTier);
+            jobOptions.decode.asrModel = tiers.Tier(tier);
+        }
+        std::cout << "Job started: " << job.key;
+        if (!jobOptions.modelTier.empty()) {
+            std::cout << ", model tier " << jobOptions.modelTier;
+        }
+        std::cout << std::endl;
+        jobOptions.inputFiles.clear();
+        for (const auto& track : job.files) {
+            std::string path = (directory / track).string();
+            WavReader wav;
+            if (!wav.Open(path)) {
+                std::cerr << "Error: Job failed, unreadable track: " << path << std::endl;
+                if (tiers.Configured()) {
+                    tiers.Finish(tier, AudioSeconds(job), 0.0);
+                }
+                return false;
             }
-            fullTranscription += transcriptions[j];
+            jobOptions.inputFiles.push_back(path);
+        }
+        if (jobOptions.outputDirectory.empty()) {
+            jobOptions.outputDirectory = directory.string();
         }
         
-        std::cout << "Transcription completed in " << duration.count() << " ms" << std::endl;
-        std::cout << "Transcription: " << (fullTranscription.empty() ? "No speech detected" : fullTranscription) << std::endl;
-        
-        // Cleanup
-        SherpaOnnxFreeWave(wave);
+        RecordingSetResult result = ProcessRecordingSet(engine, jobOptions);
+        // A failed job writes no transcript and keeps its journals, so a retry resumes
+        if (result.failedFiles == 0 && !result.segments.empty() && !result.transcriptFilename.empty()) {
+            ExportRecordingSet(result, jobOptions);
+        }
+        ReportStageStats(result, jobOptions.statsJsonPath);
+        if (tiers.Configured()) {
+            tiers.Finish(tier, AudioSeconds(job), result.wallSeconds);
+        }
         
-        return fullTranscription.empty() ? "No speech detected" : fullTranscription;
+        if (result.failedFiles > 0) {
+            std::cerr << "Error: Job failed: " << job.key << " (" << result.failedFiles << " of " << job.files.size()
+                      << " track(s) could not be transcribed)" << std::endl;
+            return false;
+        }
+        std::cout << "Job done: " << job.key << " -> "
+                  << (result.segments.empty() ? "no speech" : result.transcriptFilename) << std::endl;
+        return true;
     }
+};
+
+// Decodes prefixes of growing length from a file and prints how decode time scales,
+// which is what the --max-segment default is chosen from.
+int RunDecodeBenchmark(TranscriptionEngine& engine, const std::string& wavFile) {
+    WavReader wav;
+    if (!wav.Open(wavFile)) {
+        std::cerr << "Error: --bench-decode needs a readable WAV file: " << wavFile << std::endl;
+        return 1;
+    }
+    ResampledSource audio(wav, 16000);
     
-    std::vector<SpeakerSegment> TranscribeWithDiarization(const std::string& wavFile) {
-        std::vector<SpeakerSegment> result;
-        
-        if (!recognizer || !vad || !diarization) {
-            std::cerr << "Error: Transcription engine not initialized" << std::endl;
-            return result;
+    // Only the longest benchmarked span is ever decoded, so only that much is converted
+    std::vector<float> buffer;
+    const float* samples = audio.Span(0, 60 * 16000, buffer);
+    int32_t numSamples = static_cast<int32_t>(buffer.size());
+    
+    const float lengths[] = {2.0f, 5.0f, 10.0f, 15.0f, 20.0f, 30.0f, 45.0f, 60.0f};
+    const int kRepetitions = 3;
+    
+    // The first call pays for graph optimization and would skew the shortest length
+    engine.DecodeSamples(samples, std::min<int32_t>(numSamples, 16000));
+    
+    std::cout << "Segment length vs decode time (median of " << kRepetitions << ")" << std::endl;
+    std::cout << "  length_s   decode_ms   ms_per_audio_s   rtf" << std::endl;
+    for (float seconds : lengths) {
+        int32_t n = static_cast<int32_t>(seconds * 16000);
+        if (n > numSamples) {
+            break;
         }
         
-        if (!std::filesystem::exists(wavFile)) {
-            std::cerr << "Error: Audio file not found: " << wavFile << std::endl;
-            return result;
+        std::vector<double> timesMs;
+        for (int rep = 0; rep < kRepetitions; ++rep) {
+            auto start = std::chrono::steady_clock::now();
+            engine.DecodeSamples(samples, n);
+            timesMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
         }
+        std::sort(timesMs.begin(), timesMs.end());
+        double medianMs = timesMs[kRepetitions / 2];
         
-        std::cout << "Transcribing with speaker diarization: " << wavFile << std::endl;
-        
-        // Read the WAV file
-        const SherpaOnnxWave* wave = SherpaOnnxReadWave(wavFile.c_str());
-        if (wave == nullptr) {
-            std::cerr << "Error: Failed to read WAV file: " << wavFile << std::endl;
-            return result;
+        std::cout << std::fixed << std::setprecision(1)
+                  << std::setw(10) << seconds
+                  << std::setw(12) << medianMs
+                  << std::setw(17) << medianMs / seconds
+                  << std::setprecision(3) << std::setw(8) << medianMs / (seconds * 1000.0)
+                  << std::defaultfloat << std::setprecision(6) << std::endl;
+    }
+    
+    return 0;
+}
+
+// Times the VAD fed in bulk against the old loop that submitted one 512-sample window per
+// call and stopped before the last window, and checks that both find the same speech
+// boundaries. Regions may only differ where the old loop lost the tail of the file.
+// Returns 1 if any other boundary moved.
+int RunVadBenchmark(TranscriptionEngine& engine, const std::vector<std::string>& wavFiles) {
+    const int64_t kWindowSamples = 512;
+    const int kRepetitions = 3;
+    
+    auto medianRun = [&](const std::string& wavFile, int64_t feedSamples, bool dropLastWindow,
+                         std::vector<std::pair<int64_t, int64_t>>& regions, double& medianMs) {
+        std::vector<double> timesMs;
+        for (int rep = 0; rep < kRepetitions; ++rep) {
+            double detectorMs = 0.0;
+            if (!engine.DetectSpeech(wavFile, feedSamples, dropLastWindow, regions, detectorMs)) {
+                return false;
+            }
+            timesMs.push_back(detectorMs);
         }
-        
-        // Check sample rate
-        if (wave->sample_rate != 16000) {
-            std::cerr << "Warning: Expected sample rate 16000 Hz, got " << wave->sample_rate << " Hz" << std::endl;
-            SherpaOnnxFreeWave(wave);
-            return result;
+        std::sort(timesMs.begin(), timesMs.end());
+        medianMs = timesMs[kRepetitions / 2];
+        return true;
+    };
+    
+    std::cout << "VAD feeding: " << kWindowSamples << "-sample windows vs " << TranscriptionEngine::kVadFeedSamples
+              << "-sample blocks (median of " << kRepetitions << ")" << std::endl;
+    std::cout << "  audio_s   calls_old  calls_new   old_ms    new_ms  speedup  regions  same  tail  moved  file" << std::endl;
+    
+    double totalOldMs = 0.0, totalNewMs = 0.0;
+    int totalMoved = 0;
+    for (const auto& wavFile : wavFiles) {
+        WavReader wav;
+        if (!wav.Open(wavFile)) {
+            continue;
         }
+        int64_t numSamples = ResampledSource(wav, 16000).NumSamples();
+        int64_t oldFedSamples = std::max<int64_t>(0, (numSamples - 1) / kWindowSamples * kWindowSamples);
         
-        std::cout << "Audio info - Sample rate: " << wave->sample_rate << " Hz, Samples: " << wave->num_samples << std::endl;
-        
-        // Perform speaker diarization
-        auto start_time = std::chrono::high_resolution_clock::now();
-        
-        const SherpaOnnxOfflineSpeakerDiarizationResult* diarizationResult = 
-            SherpaOnnxOfflineSpeakerDiarizationProcess(diarization, wave->samples, wave->num_samples);
-        
-        if (diarizationResult == nullptr) {
-            std::cerr << "Error: Failed to perform speaker diarization" << std::endl;
-            SherpaOnnxFreeWave(wave);
-            return result;
+        std::vector<std::pair<int64_t, int64_t>> oldRegions, newRegions;
+        double oldMs = 0.0, newMs = 0.0;
+        if (!medianRun(wavFile, kWindowSamples, true, oldRegions, oldMs) ||
+            !medianRun(wavFile, TranscriptionEngine::kVadFeedSamples, false, newRegions, newMs)) {
+            continue;
         }
         
-        int32_t num_segments = SherpaOnnxOfflineSpeakerDiarizationResultGetNumSegments(diarizationResult);
-        const SherpaOnnxOfflineSpeakerDiarizationSegment* segments = 
-            SherpaOnnxOfflineSpeakerDiarizationResultSortByStartTime(diarizationResult);
-        
-        std::cout << "Found " << num_segments << " speaker segments" << std::endl;
-        
-        // Process each speaker segment with transcription
-        for (int32_t i = 0; i < num_segments; ++i) {
-            float segment_start = segments[i].start;
-            float segment_end = segments[i].end;
-            int speaker_id = segments[i].speaker;
-            
-            // Extract audio segment
-            int32_t start_sample = static_cast<int32_t>(segment_start * wave->sample_rate);
-            int32_t end_sample = static_cast<int32_t>(segment_end * wave->sample_rate);
-            int32_t segment_length = end_sample - start_sample;
-            
-            if (segment_length <= 0) continue;
-            
-            // Create a copy of the audio segment
-            std::vector<float> segment_audio(wave->samples + start_sample, wave->samples + end_sample);
-            
-            // Transcribe this segment
-            const SherpaOnnxOfflineStream* stream = SherpaOnnxCreateOfflineStream(recognizer);
-            SherpaOnnxAcceptWaveformOffline(stream, wave->sample_rate, segment_audio.data(), segment_length);
-            SherpaOnnxDecodeOfflineStream(recognizer, stream);
-            
-            const SherpaOnnxOfflineRecognizerResult* transcriptionResult = SherpaOnnxGetOfflineStreamResult(stream);
-            std::string text = transcriptionResult ? transcriptionResult->text : "";
-            
-            if (!text.empty()) {
-                SpeakerSegment segment;
-                segment.start = segment_start;
-                segment.end = segment_end;
-                segment.speaker = speaker_id;
-                segment.text = text;
-                result.push_back(segment);
-                
-                std::cout << "Speaker " << speaker_id << " [" << segment_start << "s - " << segment_end << "s]: " << text << std::endl;
-            }
-            
-            // Cleanup
-            if (transcriptionResult) {
-                SherpaOnnxDestroyOfflineRecognizerResult(transcriptionResult);
+        // A difference is explained by the recovered tail if the old region was cut off by the
+        // early flush, or the new region lies (partly) in the samples the old loop never fed
+        int same = 0, tail = 0, moved = 0;
+        for (size_t r = 0; r < std::max(oldRegions.size(), newRegions.size()); ++r) {
+            bool haveOld = r < oldRegions.size();
+            bool haveNew = r < newRegions.size();
+            if (haveOld && haveNew && oldRegions[r] == newRegions[r]) {
+                ++same;
+            } else if ((haveOld && oldRegions[r].second >= oldFedSamples) || (!haveOld && newRegions[r].second > oldFedSamples)) {
+                ++tail;
+            } else {
+                ++moved;
+                std::cout << "  moved: " << wavFile << " region " << r << " old ["
+                          << (haveOld ? oldRegions[r].first / 16000.0 : 0.0) << "s - " << (haveOld ? oldRegions[r].second / 16000.0 : 0.0)
+                          << "s] new [" << (haveNew ? newRegions[r].first / 16000.0 : 0.0) << "s - "
+                          << (haveNew ? newRegions[r].second / 16000.0 : 0.0) << "s]" << std::endl;
             }
-            SherpaOnnxDestroyOfflineStream(stream);
         }
         
-        auto end_time = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-        
-        std::cout << "Speaker diarization and transcription completed in " << duration.count() << " ms" << std::endl;
+        int64_t oldCalls = oldFedSamples / kWindowSamples;
+        int64_t newCalls = (numSamples + TranscriptionEngine::kVadFeedSamples - 1) / TranscriptionEngine::kVadFeedSamples;
+        std::cout << std::fixed << std::setprecision(1)
+                  << std::setw(9) << numSamples / 16000.0
+                  << std::setw(12) << oldCalls
+                  << std::setw(11) << newCalls
+                  << std::setw(9) << oldMs
+                  << std::setw(10) << newMs
+                  << std::setprecision(2) << std::setw(8) << (newMs > 0.0 ? oldMs / newMs : 0.0) << "x"
+                  << std::setw(9) << newRegions.size()
+                  << std::setw(6) << same
+                  << std::setw(6) << tail
+                  << std::setw(7) << moved
+                  << "  " << wavFile << std::defaultfloat << std::setprecision(6) << std::endl;
         
-        // Cleanup
-        SherpaOnnxOfflineSpeakerDiarizationDestroySegment(segments);
-        SherpaOnnxOfflineSpeakerDiarizationDestroyResult(diarizationResult);
-        SherpaOnnxFreeWave(wave);
-        
-        return result;
+        totalOldMs += oldMs;
+        totalNewMs += newMs;
+        totalMoved += moved;
     }
     
-    bool IsInitialized() const {
-        return recognizer != nullptr && vad != nullptr && diarization != nullptr;
-    }
-};
-
-void PrintUsage(const char* programName) {
-    std::cout << "Usage: " << programName << " <wav_file1> [wav_file2] ..." << std::endl;
-    std::cout << "Example: " << programName << " recording_20250912_152706_microphone.wav recording_20250912_152706_system.wav" << std::endl;
-    std::cout << "The ASR model files should be in: models/sherpa-onnx-moonshine-base-en-int8/" << std::endl;
-    std::cout << "The VAD model file should be: models/silero_vad.int8.onnx" << std::endl;
-    std::cout << "The segmentation model should be: models/sherpa-onnx-pyannote-segmentation-3-0/model.onnx" << std::endl;
-    std::cout << "The embedding model should be: models/nemo_en_titanet_small.onnx" << std::endl;
+    std::cout << std::fixed << std::setprecision(1) << "Total: " << totalOldMs << " ms -> " << totalNewMs << " ms; "
+              << totalMoved << " boundary change(s) outside the tail" << std::defaultfloat << std::setprecision(6) << std::endl;
+    return totalMoved > 0 ? 1 : 0;
 }
 
-std::string GenerateTranscriptFilename(const std::string& audioFile) {
-    // Extract the base filename without extension
-    std::filesystem::path path(audioFile);
-    std::string stem = path.stem().string();
+// Sends the command line to a running daemon and relays its results.
+// Returns -1 if no daemon is reachable so the caller can fall back to in-process transcription.
+int RunClient(const TranscribeOptions& options, const std::vector<std::string>& args) {
+    SocketHandle sock = ConnectToDaemon(options.socketPath);
+    if (sock == kInvalidSocket) {
+        return -1;
+    }
     
-    // Replace "recording" with "transcript" and remove "_microphone" or "_system" suffix
-    std::string transcriptName = stem;
+    std::cout << "Submitting job to transcription daemon at " << options.socketPath << std::endl;
     
-    // Remove "_microphone" or "_system" suffix if present
-    size_t pos = transcriptName.find("_microphone");
-    if (pos != std::string::npos) {
-        transcriptName = transcriptName.substr(0, pos);
-    } else {
-        pos = transcriptName.find("_system");
-        if (pos != std::string::npos) {
-            transcriptName = transcriptName.substr(0, pos);
+    MessageWriter request;
+    request.PutU32(kProtocolVersion);
+    request.PutString(std::filesystem::current_path().string());
+    request.PutU32(static_cast<uint32_t>(args.size()));
+    for (const auto& arg : args) {
+        request.PutString(arg);
+    }
+    
+    MessageType type;
+    std::string payload;
+    if (!SendFrame(sock, MessageType::JobRequest, request.Data())) {
+        // A busy daemon turns the connection away before reading the job; show its reason
+        if (ReceiveFrame(sock, type, payload) && type == MessageType::Error) {
+            std::cerr << "Error: " << MessageReader(payload).GetString() << std::endl;
+        } else {
+            std::cerr << "Error: Failed to send job to daemon" << std::endl;
         }
+        CloseSocket(sock);
+        return 1;
     }
     
-    // Replace "recording" with "transcript"
-    pos = transcriptName.find("recording");
-    if (pos != std::string::npos) {
-        transcriptName.replace(pos, 9, "transcript");
+    int exitCode = 1;
+    bool rejected = false;  // The daemon answered with an error rather than going away
+    while (ReceiveFrame(sock, type, payload)) {
+        MessageReader reader(payload);
+        if (type == MessageType::Status) {
+            std::cout << reader.GetString() << std::endl;
+        } else if (type == MessageType::Segment) {
+            SpeakerSegment segment;
+            segment.start = reader.GetF32();
+            segment.end = reader.GetF32();
+            segment.speaker = reader.GetI32();
+            segment.text = reader.GetString();
+            std::cout << "Speaker " << segment.speaker << " [" << segment.start << "s - " 
+                      << segment.end << "s]: " << segment.text << std::endl;
+        } else if (type == MessageType::Done) {
+            std::string transcriptPath = reader.GetString();
+            uint32_t numSegments = reader.GetU32();
+            if (transcriptPath.empty()) {
+                std::cout << "No segments found to combine." << std::endl;
+            } else {
+                std::cout << "Total segments: " << numSegments << std::endl;
+                std::cout << "Combined transcript exported to: " << transcriptPath << std::endl;
+            }
+            exitCode = 0;
+            break;
+        } else if (type == MessageType::Error) {
+            std::cerr << "Error: " << reader.GetString() << std::endl;
+            rejected = true;
+            break;
+        }
     }
     
-    return transcriptName + ".txt";
+    CloseSocket(sock);
+    if (exitCode == 0) {
+        std::cout << "Transcription process completed." << std::endl;
+    } else if (!rejected) {
+        std::cerr << "Error: Lost connection to the transcription daemon" << std::endl;
+    }
+    return exitCode;
 }
 
-void ExportCombinedTranscript(const std::vector<SpeakerSegment>& allSegments, const std::string& filename) {
-    std::ofstream file(filename);
-    if (!file.is_open()) {
-        std::cerr << "Error: Failed to create transcript file: " << filename << std::endl;
-        return;
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        PrintUsage(argv[0]);
+        return 1;
     }
     
-    file << "=== Combined Transcript ===" << std::endl;
-    
-    // Get current time and format it
-    auto now = std::chrono::system_clock::now();
-    auto time_t = std::chrono::system_clock::to_time_t(now);
-    file << "Generated: " << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S") << std::endl;
-    file << "Total segments: " << allSegments.size() << std::endl;
-    file << std::endl;
+    std::vector<std::string> args(argv + 1, argv + argc);
+    TranscribeOptions options;
+    std::string error;
+    if (!ParseArguments(args, options, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        PrintUsage(argv[0]);
+        return 1;
+    }
     
-    for (const auto& segment : allSegments) {
-        file << "[" << std::fixed << std::setprecision(2) << segment.start << "s - " 
-             << segment.end << "s] Speaker " << segment.speaker << ": " << segment.text << std::endl;
+    // Re-clustering only needs the saved embeddings, not the models
+    if (!options.reclusterFile.empty()) {
+        return RunRecluster(options);
+    }
+    if (!options.convertFile.empty()) {
+        return RunConvert(options);
     }
     
-    file.close();
-    std::cout << "Combined transcript exported to: " << filename << std::endl;
-}
-
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
+    bool benchmark = !options.benchDecodeFile.empty() || !options.benchVadFiles.empty();
+    bool resident = options.serve || !options.watchDirectory.empty();
+    if (!resident && options.inputFiles.empty() && !benchmark) {
         PrintUsage(argv[0]);
         return 1;
     }
     
+    SocketLibrary socketLibrary;
+    
+    // Hand the job to a resident daemon if one is running
+    if (!resident && !options.noDaemon && !benchmark) {
+        int clientResult = RunClient(options, args);
+        if (clientResult >= 0) {
+            return clientResult;
+        }
+    }
+    
     // Initialize the transcription engine
     std::string modelDir = "models/sherpa-onnx-moonshine-base-en-int8";
     std::string vadModelFile = "models/silero_vad.int8.onnx";
     std::string segmentationModel = "models/sherpa-onnx-pyannote-segmentation-3-0/model.onnx";
     std::string embeddingModel = "models/nemo_en_titanet_small.onnx";
-    TranscriptionEngine engine(modelDir, vadModelFile, segmentationModel, embeddingModel);
+    std::string fastModelDir = "models/sherpa-onnx-moonshine-tiny-en-int8";
+    TranscriptionEngine engine(modelDir, vadModelFile, segmentationModel, embeddingModel, fastModelDir);
+    engine.SetOptimizedModelCache(options.optimizedModelCache);
     
-    if (!engine.IsInitialized()) {
+    // Only the models the selected mode always needs are loaded now; the daemon loads
+    // whatever its jobs need on first use and keeps it resident afterwards.
+    unsigned preloadModels = ModelsForMode(options.mode);
+    if (options.decode.cascade && (preloadModels & kRecognizerModel)) {
+        preloadModels |= kFastRecognizerModel;
+    }
+    if (benchmark) {
+        preloadModels = (options.benchDecodeFile.empty() ? 0u : kRecognizerModel) | (options.benchVadFiles.empty() ? 0u : kVadModel);
+    } else if (!resident && options.silence.enabled) {
+        // Tracks are checked for silence as they are processed, and the models only loaded for
+        // the first one with sound, so a recording whose tracks are all silent loads none
+        options.deferredModels = preloadModels;
+        preloadModels = 0;
+    }
+    if (!engine.Initialize(preloadModels, options.warmUp)) {
         std::cerr << "Failed to initialize transcription engine" << std::endl;
         return 1;
     }
     
-    std::cout << "=== Custom AI Note Taker - Combined Transcript Generator ===" << std::endl;
-    std::cout << "Processing " << (argc - 1) << " audio file(s)..." << std::endl;
-    std::cout << std::endl;
-    
-    std::vector<SpeakerSegment> allSegments;
-    int maxMicrophoneSpeakerId = 0;
-    std::string transcriptFilename;
+    if (!options.benchDecodeFile.empty()) {
+        return RunDecodeBenchmark(engine, options.benchDecodeFile);
+    }
+    if (!options.benchVadFiles.empty()) {
+        return RunVadBenchmark(engine, options.benchVadFiles);
+    }
     
-    // Process each audio file
-    for (int i = 1; i < argc; i++) {
-        std::string wavFile = argv[i];
-        std::cout << "[" << i << "/" << (argc - 1) << "] Processing: " << wavFile << std::endl;
-        
-        // Try speaker diarization first
-        std::vector<SpeakerSegment> segments = engine.TranscribeWithDiarization(wavFile);
-        
-        if (segments.empty()) {
-            std::cout << "No speaker segments found, falling back to VAD-only transcription" << std::endl;
-            std::string transcription = engine.TranscribeFile(wavFile);
-            
-            if (!transcription.empty()) {
-                // Create a single segment for the entire transcription
-                SpeakerSegment segment;
-                segment.start = 0.0f;
-                segment.end = 10.0f; // Default duration
-                segment.speaker = 1;
-                segment.text = transcription;
-                segments.push_back(segment);
-            }
+    if (options.serve) {
+        if (!options.startupJsonPath.empty()) {
+            engine.WriteStartupJson(options.startupJsonPath);
         }
-        
-        if (!segments.empty()) {
-            std::cout << "Found " << segments.size() << " speaker segments" << std::endl;
-            
-            // Determine if this is microphone or system audio based on filename
-            bool isMicrophoneAudio = wavFile.find("_microphone") != std::string::npos;
-            int speakerIdOffset = isMicrophoneAudio ? 0 : maxMicrophoneSpeakerId;
-            
-            // Remap speaker IDs to ensure distinct identities
-            for (auto& segment : segments) {
-                segment.speaker += speakerIdOffset;
-                
-                // Track the maximum speaker ID for microphone audio
-                if (isMicrophoneAudio) {
-                    maxMicrophoneSpeakerId = std::max(maxMicrophoneSpeakerId, segment.speaker);
-                }
-                
-                allSegments.push_back(segment);
-            }
-            
-            // Generate transcript filename from the first audio file
-            if (transcriptFilename.empty()) {
-                transcriptFilename = GenerateTranscriptFilename(wavFile);
-            }
-            
-            std::cout << "Successfully processed: " << wavFile << std::endl;
-        } else {
-            std::cout << "Failed to process: " << wavFile << std::endl;
+        TranscriptionServer server(engine, options.socketPath, options);
+        return server.Run();
+    }
+    if (!options.watchDirectory.empty()) {
+        if (!options.startupJsonPath.empty()) {
+            engine.WriteStartupJson(options.startupJsonPath);
         }
-        
-        std::cout << std::endl;
+        DirectoryWatcher watcher(engine, options);
+        return watcher.Run();
     }
     
-    if (!allSegments.empty()) {
-        // Sort all segments by start time
-        std::sort(allSegments.begin(), allSegments.end(), 
-                  [](const SpeakerSegment& a, const SpeakerSegment& b) {
-                      return a.start < b.start;
-                  });
-        
-        // Display combined results
-        std::cout << "=== Combined Transcript Summary ===" << std::endl;
-        std::cout << "Total segments: " << allSegments.size() << std::endl;
-        
-        // Group by speaker for summary
-        std::map<int, std::vector<SpeakerSegment>> speakerGroups;
-        for (const auto& segment : allSegments) {
-            speakerGroups[segment.speaker].push_back(segment);
-        }
-        
-        std::cout << "Speakers found: " << speakerGroups.size() << std::endl;
-        for (const auto& pair : speakerGroups) {
-            int speakerId = pair.first;
-            const auto& speakerSegments = pair.second;
-            std::cout << "  Speaker " << speakerId << " (" << speakerSegments.size() << " segments)" << std::endl;
-        }
+    std::cout << "=== Custom AI Note Taker - Combined Transcript Generator ===" << std::endl;
+    
+    RecordingSetResult result = ProcessRecordingSet(engine, options);
+    
+    if (!result.segments.empty()) {
+        PrintTranscriptSummary(result.segments);
         
         // Export to file
-        if (!transcriptFilename.empty()) {
-            ExportCombinedTranscript(allSegments, transcriptFilename);
+        if (!result.transcriptFilename.empty()) {
+            ExportRecordingSet(result, options);
         }
     } else {
         std::cout << "No segments found to combine." << std::endl;
     }
     
+    ReportStageStats(result, options.statsJsonPath);
+    
+    if (!options.startupJsonPath.empty()) {
+        engine.WriteStartupJson(options.startupJsonPath);
+    }
+    
     std::cout << "Transcription process completed." << std::endl;
     return 0;
 }
@@ -0,0 +1,652 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <ctime>
+#include <thread>
+#include <map>
+#include <cstring>
+#include <cctype>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include "transcription_engine.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Throughput benchmark for the transcription engine. Runs every combination of model variant,
+// ASR worker count and maximum segment length over a corpus of WAV files (or generated
+// speech-like mixtures) and writes the results, with a description of the host, as JSON.
+
+struct BenchOptions {
+    std::vector<std::string> corpus;       // WAV files and directories of WAV files
+    bool synthetic = false;
+    std::vector<float> durations = {60.0f, 300.0f};  // Seconds, for --synthetic
+    std::vector<int> speakers = {1, 2};               // Speakers per mixture, for --synthetic
+    std::vector<int> threads;                         // ASR workers; empty = 1 and one per core
+    std::vector<float> maxSegments = {15.0f};         // Decode batch length in seconds
+    std::vector<std::string> asrModels = {"models/sherpa-onnx-moonshine-base-en-int8"};
+    std::string cascadeModel;  // Fast model; every configuration is also run as a cascade with it
+    TranscriptionMode mode = TranscriptionMode::Diarize;
+    int repeat = 1;
+    std::string workDirectory;  // Where generated mixtures are written
+    std::string outputPath = "transcribe_bench.json";
+};
+
+// One benchmarked configuration
+struct BenchRun {
+    std::string model;
+    bool cascade = false;
+    double redecodedFraction = 0.0;  // Cascade spans re-decoded by the main model
+    double werVsMain = 0.0;          // Cascade word error rate, taking the main model's output as reference
+    int threads = 0;
+    float maxSegmentSeconds = 0.0f;
+    size_t files = 0;
+    double audioSeconds = 0.0;
+    double wallSeconds = 0.0;
+    size_t segments = 0;
+    size_t asrCalls = 0;
+    double p50Ms = 0.0;
+    double p95Ms = 0.0;
+    double p99Ms = 0.0;
+    double peakRssMb = 0.0;  // Highest resident memory sampled while this configuration ran
+};
+
+template <typename T>
+bool ParseList(const std::string& value, std::vector<T>& list) {
+    list.clear();
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        std::stringstream itemStream(item);
+        T parsed;
+        if (!(itemStream >> parsed)) {
+            return false;
+        }
+        list.push_back(parsed);
+    }
+    return !list.empty();
+}
+
+bool ParseArguments(const std::vector<std::string>& args, BenchOptions& options, std::string& error) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        
+        auto nextValue = [&](std::string& value) {
+            if (i + 1 >= args.size()) {
+                error = "Missing value for " + arg;
+                return false;
+            }
+            value = args[++i];
+            return true;
+        };
+        
+        std::string value;
+        if (arg == "--corpus") {
+            if (!nextValue(value)) return false;
+            options.corpus.push_back(value);
+        } else if (arg == "--synthetic") {
+            options.synthetic = true;
+        } else if (arg == "--durations") {
+            if (!nextValue(value) || !ParseList(value, options.durations)) {
+                error = "--durations expects a comma-separated list of seconds";
+                return false;
+            }
+        } else if (arg == "--speakers") {
+            if (!nextValue(value) || !ParseList(value, options.speakers)) {
+                error = "--speakers expects a comma-separated list of counts";
+                return false;
+            }
+        } else if (arg == "--threads") {
+            if (!nextValue(value) || !ParseList(value, options.threads)) {
+                error = "--threads expects a comma-separated list of worker counts";
+                return false;
+            }
+        } else if (arg == "--max-segment") {
+            if (!nextValue(value) || !ParseList(value, options.maxSegments)) {
+                error = "--max-segment expects a comma-separated list of seconds";
+                return false;
+            }
+        } else if (arg == "--asr-model") {
+            if (!nextValue(value)) return false;
+            options.asrModels.clear();
+            std::stringstream stream(value);
+            std::string model;
+            while (std::getline(stream, model, ',')) {
+                options.asrModels.push_back(model);
+            }
+        } else if (arg == "--cascade") {
+            if (!nextValue(options.cascadeModel)) return false;
+        } else if (arg == "--no-diarize") {
+            options.mode = TranscriptionMode::NoDiarize;
+        } else if (arg == "--repeat") {
+            if (!nextValue(value)) return false;
+            options.repeat = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--work-dir") {
+            if (!nextValue(options.workDirectory)) return false;
+        } else if (arg == "--out") {
+            if (!nextValue(options.outputPath)) return false;
+        } else {
+            error = "Unknown option: " + arg;
+            return false;
+        }
+    }
+    
+    if (options.corpus.empty() && !options.synthetic) {
+        error = "Give a corpus with --corpus or use --synthetic";
+        return false;
+    }
+    if (options.threads.empty()) {
+        options.threads = {1};
+        int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        if (cores > 1) {
+            options.threads.push_back(cores);
+        }
+    }
+    return true;
+}
+
+void PrintUsage(const char* programName) {
+    std::cout << "Usage: " << programName << " (--corpus <wav|dir> ... | --synthetic) [options]" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --corpus <path>        WAV file or directory of them (repeatable)" << std::endl;
+    std::cout << "  --synthetic            Generate speech-like mixtures instead of (or besides) a corpus" << std::endl;
+    std::cout << "  --durations <s,...>    Mixture durations in seconds (default: 60,300)" << std::endl;
+    std::cout << "  --speakers <n,...>     Speakers per mixture (default: 1,2)" << std::endl;
+    std::cout << "  --threads <n,...>      ASR worker counts to compare (default: 1 and one per core)" << std::endl;
+    std::cout << "  --max-segment <s,...>  Decode batch lengths in seconds to compare (default: 15)" << std::endl;
+    std::cout << "  --asr-model <dir,...>  ASR model variants to compare" << std::endl;
+    std::cout << "  --cascade <dir>        Also run every configuration as a cascade with this fast model, and" << std::endl;
+    std::cout << "                         report how much was re-decoded and the WER against the main model" << std::endl;
+    std::cout << "  --no-diarize           Benchmark VAD + ASR without diarization" << std::endl;
+    std::cout << "  --repeat <n>           Passes over the corpus per configuration (default: 1)" << std::endl;
+    std::cout << "  --work-dir <dir>       Where generated mixtures are written (default: temp directory)" << std::endl;
+    std::cout << "  --out <file>           JSON results (default: transcribe_bench.json)" << std::endl;
+}
+
+// Peak resident memory over one configuration. The process-wide high-water mark never comes
+// down, and would still include the engines of earlier model variants, so the current RSS is
+// sampled on a background thread instead.
+class RssSampler {
+private:
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    double peakMb = 0.0;
+    std::thread thread;
+    
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        do {
+            peakMb = std::max(peakMb, CurrentRssMb());
+        } while (!wake.wait_for(lock, std::chrono::milliseconds(20), [this] { return stopping; }));
+    }
+    
+public:
+    RssSampler() : peakMb(CurrentRssMb()), thread(&RssSampler::Run, this) {}
+    
+    ~RssSampler() {
+        Stop();
+    }
+    
+    double Stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (thread.joinable()) {
+            thread.join();
+        }
+        return std::max(peakMb, CurrentRssMb());
+    }
+};
+
+// Lower-cased words of a transcript, in time order
+std::vector<std::string> TranscriptWords(const std::vector<SpeakerSegment>& segments) {
+    std::vector<std::string> words;
+    for (const auto& segment : segments) {
+        std::istringstream stream(segment.text);
+        std::string word;
+        while (stream >> word) {
+            std::transform(word.begin(), word.end(), word.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            words.push_back(word);
+        }
+    }
+    return words;
+}
+
+// Word-level edit distance (substitutions, insertions and deletions)
+size_t WordEdits(const std::vector<std::string>& reference, const std::vector<std::string>& hypothesis) {
+    std::vector<size_t> previous(hypothesis.size() + 1), current(hypothesis.size() + 1);
+    for (size_t j = 0; j <= hypothesis.size(); ++j) {
+        previous[j] = j;
+    }
+    for (size_t i = 1; i <= reference.size(); ++i) {
+        current[0] = i;
+        for (size_t j = 1; j <= hypothesis.size(); ++j) {
+            size_t substitution = previous[j - 1] + (reference[i - 1] == hypothesis[j - 1] ? 0 : 1);
+            current[j] = std::min(substitution, std::min(previous[j], current[j - 1]) + 1);
+        }
+        std::swap(previous, current);
+    }
+    return previous[hypothesis.size()];
+}
+
+bool WriteWav(const std::string& path, const std::vector<float>& samples, int sampleRate) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not create file " << path << std::endl;
+        return false;
+    }
+    
+    auto put32 = [&file](uint32_t value) {
+        char bytes[4] = {static_cast<char>(value), static_cast<char>(value >> 8), static_cast<char>(value >> 16), static_cast<char>(value >> 24)};
+        file.write(bytes, 4);
+    };
+    auto put16 = [&file](uint16_t value) {
+        char bytes[2] = {static_cast<char>(value), static_cast<char>(value >> 8)};
+        file.write(bytes, 2);
+    };
+    
+    uint32_t dataBytes = static_cast<uint32_t>(samples.size() * 2);
+    file.write("RIFF", 4);
+    put32(36 + dataBytes);
+    file.write("WAVEfmt ", 8);
+    put32(16);
+    put16(1);  // PCM
+    put16(1);  // Mono
+    put32(sampleRate);
+    put32(sampleRate * 2);
+    put16(2);
+    put16(16);
+    file.write("data", 4);
+    put32(dataBytes);
+    for (float sample : samples) {
+        put16(static_cast<uint16_t>(static_cast<int16_t>(std::max(-1.0f, std::min(1.0f, sample)) * 32767.0f)));
+    }
+    return true;
+}
+
+// Speech-like test signal: speakers take turns of 2-8 s separated by short pauses. Each
+// speaker has its own pitch and formants, and is voiced in syllable-rate bursts. The ASR
+// output is meaningless, but VAD, diarization and decode cost behave much like on speech.
+std::vector<float> GenerateMixture(float durationSeconds, int numSpeakers, unsigned seed) {
+    const int sampleRate = 16000;
+    const float kPi = 3.14159265f;
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    
+    struct Voice {
+        float pitch;
+        float formant1;
+        float formant2;
+    };
+    std::vector<Voice> voices;
+    for (int s = 0; s < numSpeakers; ++s) {
+        voices.push_back({95.0f + 135.0f * uniform(random), 500.0f + 400.0f * uniform(random), 1200.0f + 1200.0f * uniform(random)});
+    }
+    
+    size_t total = static_cast<size_t>(durationSeconds * sampleRate);
+    std::vector<float> samples(total, 0.0f);
+    size_t position = static_cast<size_t>(0.5f * sampleRate);
+    int speaker = 0;
+    while (position < total) {
+        const Voice& voice = voices[speaker];
+        size_t turnEnd = std::min(total, position + static_cast<size_t>((2.0f + 6.0f * uniform(random)) * sampleRate));
+        float phase = 0.0f;
+        
+        // Syllables of 120-300 ms with short gaps between them
+        while (position < turnEnd) {
+            size_t syllable = static_cast<size_t>((0.12f + 0.18f * uniform(random)) * sampleRate);
+            float pitch = voice.pitch * (0.9f + 0.2f * uniform(random));
+            for (size_t n = 0; n < syllable && position + n < turnEnd; ++n) {
+                float envelope = std::sin(kPi * n / syllable);
+                phase += 2.0f * kPi * pitch / sampleRate;
+                float value = 0.0f;
+                for (int harmonic = 1; harmonic * pitch < 4000.0f; ++harmonic) {
+                    float frequency = harmonic * pitch;
+                    float gain = std::exp(-std::pow((frequency - voice.formant1) / 250.0f, 2.0f)) +
+                                 0.6f * std::exp(-std::pow((frequency - voice.formant2) / 350.0f, 2.0f)) + 0.02f;
+                    value += gain * std::sin(harmonic * phase);
+                }
+                samples[position + n] = 0.15f * envelope * value;
+            }
+            position += syllable + static_cast<size_t>((0.02f + 0.08f * uniform(random)) * sampleRate);
+        }
+        
+        position = turnEnd + static_cast<size_t>((0.3f + 1.2f * uniform(random)) * sampleRate);
+        if (numSpeakers > 1) {
+            speaker = (speaker + 1 + static_cast<int>(uniform(random) * (numSpeakers - 1))) % numSpeakers;
+        }
+    }
+    
+    // Low noise floor, as in a real recording
+    std::normal_distribution<float> noise(0.0f, 0.001f);
+    for (float& sample : samples) {
+        sample += noise(random);
+    }
+    return samples;
+}
+
+std::vector<std::string> CollectCorpus(const BenchOptions& options) {
+    std::vector<std::string> files;
+    for (const auto& entry : options.corpus) {
+        std::error_code ec;
+        if (std::filesystem::is_directory(entry, ec)) {
+            std::vector<std::string> directoryFiles;
+            for (const auto& file : std::filesystem::directory_iterator(entry, ec)) {
+                if (file.path().extension() == ".wav") {
+                    directoryFiles.push_back(file.path().string());
+                }
+            }
+            std::sort(directoryFiles.begin(), directoryFiles.end());
+            files.insert(files.end(), directoryFiles.begin(), directoryFiles.end());
+        } else {
+            files.push_back(entry);
+        }
+    }
+    
+    if (options.synthetic) {
+        std::filesystem::path directory = options.workDirectory.empty()
+            ? std::filesystem::temp_directory_path() / "transcribe_bench" : std::filesystem::path(options.workDirectory);
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+        
+        for (float duration : options.durations) {
+            for (int numSpeakers : options.speakers) {
+                std::ostringstream name;
+                name << "synthetic_" << static_cast<int>(duration) << "s_" << numSpeakers << "spk.wav";
+                std::string path = (directory / name.str()).string();
+                if (!std::filesystem::exists(path)) {
+                    unsigned seed = static_cast<unsigned>(duration * 1000) + static_cast<unsigned>(numSpeakers);
+                    std::cout << "Generating " << path << std::endl;
+                    if (!WriteWav(path, GenerateMixture(duration, std::max(1, numSpeakers), seed), 16000)) {
+                        continue;
+                    }
+                }
+                files.push_back(path);
+            }
+        }
+    }
+    return files;
+}
+
+std::string CpuName() {
+    char brand[49] = {0};
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int registers[4];
+    __cpuid(registers, 0x80000000);
+    if (static_cast<unsigned>(registers[0]) >= 0x80000004) {
+        for (int leaf = 0; leaf < 3; ++leaf) {
+            __cpuid(registers, 0x80000002 + leaf);
+            std::memcpy(brand + 16 * leaf, registers, 16);
+        }
+    }
+#elif defined(__x86_64__) || defined(__i386__)
+    unsigned registers[4];
+    if (__get_cpuid_max(0x80000000, nullptr) >= 0x80000004) {
+        for (unsigned leaf = 0; leaf < 3; ++leaf) {
+            __get_cpuid(0x80000002 + leaf, &registers[0], &registers[1], &registers[2], &registers[3]);
+            std::memcpy(brand + 16 * leaf, registers, 16);
+        }
+    }
+#endif
+    std::string name(brand);
+    name.erase(0, name.find_first_not_of(' '));
+    return name.empty() ? "unknown" : name;
+}
+
+std::string HostName() {
+#ifdef _WIN32
+    char name[MAX_COMPUTERNAME_LENGTH + 1];
+    DWORD size = sizeof(name);
+    if (GetComputerNameA(name, &size)) {
+        return std::string(name, size);
+    }
+#else
+    char name[256];
+    if (gethostname(name, sizeof(name)) == 0) {
+        name[sizeof(name) - 1] = '\0';
+        return name;
+    }
+#endif
+    return "unknown";
+}
+
+void WriteHostJson(std::ostream& out) {
+#if defined(_WIN32)
+    const char* os = "windows";
+#elif defined(__APPLE__)
+    const char* os = "macos";
+#elif defined(__linux__)
+    const char* os = "linux";
+#else
+    const char* os = "unknown";
+#endif
+
+#if defined(_MSC_VER)
+    std::string compiler = "msvc " + std::to_string(_MSC_VER);
+#elif defined(__clang__)
+    std::string compiler = std::string("clang ") + __clang_version__;
+#elif defined(__GNUC__)
+    std::string compiler = std::string("gcc ") + __VERSION__;
+#else
+    std::string compiler = "unknown";
+#endif
+
+#if defined(__AVX__)
+    const char* simd = "avx";
+#elif defined(TRANSCRIBE_SSE2)
+    const char* simd = "sse2";
+#else
+    const char* simd = "scalar";
+#endif
+
+#ifdef NDEBUG
+    const char* build = "release";
+#else
+    const char* build = "debug";
+#endif
+
+    std::time_t now = std::time(nullptr);
+    char timestamp[32];
+    std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    
+    out << "  \"host\": {" << std::endl;
+    out << "    \"hostname\": \"" << JsonEscape(HostName()) << "\"," << std::endl;
+    out << "    \"os\": \"" << os << "\"," << std::endl;
+    out << "    \"cpu\": \"" << JsonEscape(CpuName()) << "\"," << std::endl;
+    out << "    \"logical_cores\": " << std::thread::hardware_concurrency() << "," << std::endl;
+    out << "    \"compiler\": \"" << JsonEscape(compiler) << "\"," << std::endl;
+    out << "    \"build\": \"" << build << "\"," << std::endl;
+    out << "    \"simd\": \"" << simd << "\"," << std::endl;
+    out << "    \"timestamp\": \"" << timestamp << "\"" << std::endl;
+    out << "  }," << std::endl;
+}
+
+bool WriteResultsJson(const std::string& path, const BenchOptions& options, const std::vector<std::string>& files,
+                      const std::vector<BenchRun>& runs) {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        std::cerr << "Error: Could not create file " << path << std::endl;
+        return false;
+    }
+    
+    out << "{" << std::endl;
+    WriteHostJson(out);
+    out << "  \"mode\": \"" << (options.mode == TranscriptionMode::Diarize ? "diarize" : "no-diarize") << "\"," << std::endl;
+    out << "  \"repeat\": " << options.repeat << "," << std::endl;
+    out << "  \"corpus\": [";
+    for (size_t f = 0; f < files.size(); ++f) {
+        out << (f > 0 ? ", " : "") << "\"" << JsonEscape(files[f]) << "\"";
+    }
+    out << "]," << std::endl;
+    
+    out << std::fixed << std::setprecision(3);
+    out << "  \"runs\": [" << std::endl;
+    for (size_t r = 0; r < runs.size(); ++r) {
+        const BenchRun& run = runs[r];
+        double rtf = run.audioSeconds > 0.0 ? run.wallSeconds / run.audioSeconds : 0.0;
+        double segmentsPerSecond = run.wallSeconds > 0.0 ? run.segments / run.wallSeconds : 0.0;
+        out << "    {\"model\": \"" << JsonEscape(run.model) << "\", \"cascade\": " << (run.cascade ? "true" : "false");
+        if (run.cascade) {
+            out << ", \"cascade_model\": \"" << JsonEscape(options.cascadeModel) << "\", \"redecoded_fraction\": " << run.redecodedFraction
+                << ", \"wer_vs_main\": " << std::setprecision(4) << run.werVsMain << std::setprecision(3);
+        }
+        out << ", \"threads\": " << run.threads
+            << ", \"max_segment_seconds\": " << run.maxSegmentSeconds << ", \"files\": " << run.files
+            << ", \"audio_seconds\": " << run.audioSeconds << ", \"wall_seconds\": " << run.wallSeconds
+            << ", \"rtf\": " << std::setprecision(5) << rtf << std::setprecision(3)
+            << ", \"segments\": " << run.segments << ", \"segments_per_second\": " << segmentsPerSecond
+            << ", \"asr_calls\": " << run.asrCalls << ", \"p50_ms\": " << run.p50Ms << ", \"p95_ms\": " << run.p95Ms
+            << ", \"p99_ms\": " << run.p99Ms << ", \"peak_rss_mb\": " << run.peakRssMb << "}"
+            << (r + 1 < runs.size() ? "," : "") << std::endl;
+    }
+    out << "  ]" << std::endl;
+    out << "}" << std::endl;
+    return true;
+}
+
+void PrintResults(const std::vector<BenchRun>& runs) {
+    std::cout << std::endl << "=== Benchmark Results ===" << std::endl;
+    std::cout << std::left << std::setw(44) << "Model" << std::right << std::setw(8) << "Threads" << std::setw(8) << "Seg s"
+              << std::setw(9) << "Redec %" << std::setw(9) << "WER*"
+              << std::setw(9) << "RTF" << std::setw(9) << "Seg/s" << std::setw(9) << "p50 ms" << std::setw(9) << "p95 ms"
+              << std::setw(9) << "p99 ms" << std::setw(10) << "Peak MB" << std::endl;
+    std::cout << std::fixed;
+    for (const auto& run : runs) {
+        double rtf = run.audioSeconds > 0.0 ? run.wallSeconds / run.audioSeconds : 0.0;
+        double segmentsPerSecond = run.wallSeconds > 0.0 ? run.segments / run.wallSeconds : 0.0;
+        std::cout << std::left << std::setw(44) << (run.cascade ? run.model + " +cascade" : run.model) << std::right << std::setw(8) << run.threads
+                  << std::setw(8) << std::setprecision(1) << run.maxSegmentSeconds;
+        if (run.cascade) {
+            std::cout << std::setw(9) << 100.0 * run.redecodedFraction << std::setw(9) << std::setprecision(4) << run.werVsMain;
+        } else {
+            std::cout << std::setw(9) << "-" << std::setw(9) << "-";
+        }
+        std::cout << std::setw(9) << std::setprecision(4) << rtf
+                  << std::setw(9) << std::setprecision(2) << segmentsPerSecond << std::setprecision(1)
+                  << std::setw(9) << run.p50Ms << std::setw(9) << run.p95Ms << std::setw(9) << run.p99Ms
+                  << std::setw(10) << run.peakRssMb << std::endl;
+    }
+    if (std::any_of(runs.begin(), runs.end(), [](const BenchRun& run) { return run.cascade; })) {
+        std::cout << "WER* is measured against the main model's output for the same configuration" << std::endl;
+    }
+    std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    BenchOptions options;
+    std::string error;
+    if (args.empty() || !ParseArguments(args, options, error)) {
+        if (!error.empty()) {
+            std::cerr << "Error: " << error << std::endl;
+        }
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    
+    std::vector<std::string> files = CollectCorpus(options);
+    if (files.empty()) {
+        std::cerr << "Error: No audio files to benchmark" << std::endl;
+        return 1;
+    }
+    
+    std::string vadModelFile = "models/silero_vad.int8.onnx";
+    std::string segmentationModel = "models/sherpa-onnx-pyannote-segmentation-3-0/model.onnx";
+    std::string embeddingModel = "models/nemo_en_titanet_small.onnx";
+    
+    std::vector<BenchRun> runs;
+    for (const auto& model : options.asrModels) {
+        TranscriptionEngine engine(model, vadModelFile, segmentationModel, embeddingModel, options.cascadeModel);
+        unsigned models = ModelsForMode(options.mode) | (options.cascadeModel.empty() ? 0u : kFastRecognizerModel);
+        if (!engine.Initialize(models)) {
+            std::cerr << "Error: Failed to initialize the engine with " << model << std::endl;
+            continue;
+        }
+        
+        for (int threads : options.threads) {
+            for (float maxSegment : options.maxSegments) {
+                // The cascade run follows the plain one, whose words are its reference
+                std::map<std::string, std::vector<std::string>> referenceWords;
+                for (int cascade = 0; cascade <= (options.cascadeModel.empty() ? 0 : 1); ++cascade) {
+                    DecodeSettings decode;
+                    decode.workers = threads;
+                    decode.maxSegmentSeconds = maxSegment;
+                    decode.cascade = cascade != 0;
+                    DiarizationSettings diarization;
+                    
+                    BenchRun run;
+                    run.model = model;
+                    run.cascade = decode.cascade;
+                    run.threads = threads;
+                    run.maxSegmentSeconds = maxSegment;
+                    StageStats stats(model);
+                    size_t referenceCount = 0, edits = 0;
+                    
+                    std::cout << "=== " << model << (decode.cascade ? " +cascade" : "") << ", " << threads << " worker(s), "
+                              << maxSegment << " s segments ===" << std::endl;
+                    RssSampler rss;
+                    for (int pass = 0; pass < options.repeat; ++pass) {
+                        for (const auto& file : files) {
+                            StageStats fileStats(file);
+                            std::vector<SpeakerSegment> segments;
+                            auto start = std::chrono::steady_clock::now();
+                            if (options.mode == TranscriptionMode::Diarize) {
+                                engine.TranscribeWithDiarization(file, diarization, decode, segments, nullptr, &fileStats);
+                            } else {
+                                engine.TranscribeWithVad(file, true, segments, nullptr, &fileStats, decode);
+                            }
+                            run.wallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                            run.segments += segments.size();
+                            ++run.files;
+                            stats.Merge(fileStats);
+                            
+                            if (pass == 0 && !decode.cascade) {
+                                referenceWords[file] = TranscriptWords(segments);
+                            } else if (pass == 0) {
+                                const std::vector<std::string>& reference = referenceWords[file];
+                                referenceCount += reference.size();
+                                edits += WordEdits(reference, TranscriptWords(segments));
+                            }
+                        }
+                    }
+                    
+                    run.redecodedFraction = stats.CascadeRedecodedFraction();
+                    run.werVsMain = referenceCount > 0 ? static_cast<double>(edits) / referenceCount : 0.0;
+                    run.audioSeconds = stats.AudioSeconds();
+                    run.asrCalls = stats.AsrCallCount();
+                    run.p50Ms = stats.AsrCallPercentile(0.50);
+                    run.p95Ms = stats.AsrCallPercentile(0.95);
+                    run.p99Ms = stats.AsrCallPercentile(0.99);
+                    run.peakRssMb = rss.Stop();
+                    runs.push_back(run);
+                }
+            }
+        }
+    }
+    
+    PrintResults(runs);
+    if (!WriteResultsJson(options.outputPath, options, files, runs)) {
+        return 1;
+    }
+    std::cout << "Results written to: " << options.outputPath << std::endl;
+    return 0;
+}
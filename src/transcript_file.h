@@ -0,0 +1,240 @@
+#pragma once
+
+// Binary transcript (.tsb): the segments of a transcript as fixed-width records plus one
+// string arena, laid out so that a reader maps the file and uses it in place. Loading even a
+// large archive costs one mmap and a header check; nothing is parsed or copied.
+//
+// Layout, little-endian, every field naturally aligned:
+//   TranscriptFileHeader      at 0
+//   TranscriptSegmentRecord   x segmentCount, at segmentsOffset
+//   string arena              arenaBytes of UTF-8 text, at arenaOffset; not NUL-terminated
+// Times are sample indices at sampleRate. Fields are only ever appended, with headerSize and
+// recordSize telling how much of each a file has, so readers accept a newer version as long
+// as both are at least the sizes they know; a change older readers cannot skip gets a new magic.
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+#include "mapped_file.h"
+
+constexpr char kTranscriptFileMagic[4] = {'T', 'S', 'B', '1'};
+constexpr uint32_t kTranscriptFileVersion = 1;
+
+struct TranscriptFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t recordSize;
+    uint32_t sampleRate;
+    uint32_t reserved;
+    int64_t generatedAt;       // Unix time the transcript was written
+    uint64_t segmentCount;
+    uint64_t segmentsOffset;
+    uint64_t arenaOffset;
+    uint64_t arenaBytes;
+    uint32_t modelTierOffset;  // Model tier line of the text header, in the arena; empty if none
+    uint32_t modelTierLength;
+};
+
+struct TranscriptSegmentRecord {
+    int64_t startSample;
+    int64_t endSample;
+    int32_t speaker;
+    uint32_t textOffset;       // In the arena
+    uint32_t textLength;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(TranscriptFileHeader) == 72, "TranscriptFileHeader is part of the file format");
+static_assert(sizeof(TranscriptSegmentRecord) == 32, "TranscriptSegmentRecord is part of the file format");
+
+// Collects segments and writes them as a binary transcript
+class TranscriptFileWriter {
+private:
+    int sampleRate;
+    std::vector<TranscriptSegmentRecord> records;
+    std::string arena;
+    
+    // Appends to the arena; the format caps it at 4 GB
+    bool Store(const std::string& text, uint32_t& offset, uint32_t& length) {
+        if (arena.size() + text.size() > UINT32_MAX) {
+            return false;
+        }
+        offset = static_cast<uint32_t>(arena.size());
+        length = static_cast<uint32_t>(text.size());
+        arena += text;
+        return true;
+    }
+    
+public:
+    explicit TranscriptFileWriter(int rate = 16000) : sampleRate(rate) {}
+    
+    bool Add(double startSeconds, double endSeconds, int speaker, const std::string& text) {
+        TranscriptSegmentRecord record = {};
+        record.startSample = std::llround(startSeconds * sampleRate);
+        record.endSample = std::llround(endSeconds * sampleRate);
+        record.speaker = speaker;
+        if (!Store(text, record.textOffset, record.textLength)) {
+            return false;
+        }
+        records.push_back(record);
+        return true;
+    }
+    
+    bool Write(const std::string& filename, int64_t generatedAt, const std::string& modelTier = "") {
+        TranscriptFileHeader header = {};
+        std::memcpy(header.magic, kTranscriptFileMagic, sizeof(header.magic));
+        header.version = kTranscriptFileVersion;
+        header.headerSize = sizeof(TranscriptFileHeader);
+        header.recordSize = sizeof(TranscriptSegmentRecord);
+        header.sampleRate = static_cast<uint32_t>(sampleRate);
+        header.generatedAt = generatedAt;
+        header.segmentCount = records.size();
+        header.segmentsOffset = sizeof(TranscriptFileHeader);
+        header.arenaOffset = header.segmentsOffset + records.size() * sizeof(TranscriptSegmentRecord);
+        if (!modelTier.empty() && !Store(modelTier, header.modelTierOffset, header.modelTierLength)) {
+            std::cerr << "Error: Transcript too large for the binary format: " << filename << std::endl;
+            return false;
+        }
+        header.arenaBytes = arena.size();
+        
+        std::ofstream file(filename, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Error: Failed to create binary transcript: " << filename << std::endl;
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(TranscriptSegmentRecord)));
+        file.write(arena.data(), static_cast<std::streamsize>(arena.size()));
+        if (!file) {
+            std::cerr << "Error: Failed to write binary transcript: " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+// Read-only view of a binary transcript, mapped into memory. Open checks the header and that
+// the segment table and arena lie inside the file; text spans are checked on access.
+class MappedTranscript {
+private:
+    MappedFile file;
+    
+    const TranscriptFileHeader* header = nullptr;
+    const uint8_t* records = nullptr;
+    const char* arena = nullptr;
+    
+    bool Validate(const std::string& path) {
+        const uint8_t* view = file.Data();
+        uint64_t fileBytes = file.Size();
+        const uint16_t probe = 1;
+        if (*reinterpret_cast<const uint8_t*>(&probe) != 1) {
+            std::cerr << "Error: Binary transcripts can only be mapped on little-endian machines: " << path << std::endl;
+            return false;
+        }
+        if (fileBytes < sizeof(TranscriptFileHeader) || std::memcmp(view, kTranscriptFileMagic, sizeof(kTranscriptFileMagic)) != 0) {
+            std::cerr << "Error: Not a binary transcript: " << path << std::endl;
+            return false;
+        }
+        header = reinterpret_cast<const TranscriptFileHeader*>(view);
+        
+        // A newer version only appends fields, which the size checks below let this build skip.
+        // Offsets are checked against what is left of the file so that none of the sums can overflow
+        bool valid = header->headerSize >= sizeof(TranscriptFileHeader) && header->headerSize <= header->segmentsOffset &&
+                     header->recordSize >= sizeof(TranscriptSegmentRecord) && header->recordSize % 8 == 0 &&
+                     header->sampleRate > 0 &&
+                     header->segmentsOffset % 8 == 0 && header->segmentsOffset <= fileBytes &&
+                     header->segmentCount <= (fileBytes - header->segmentsOffset) / header->recordSize &&
+                     header->arenaOffset <= fileBytes && header->arenaBytes <= fileBytes - header->arenaOffset;
+        if (!valid) {
+            std::cerr << "Error: Corrupt binary transcript: " << path << std::endl;
+            return false;
+        }
+        records = view + header->segmentsOffset;
+        arena = reinterpret_cast<const char*>(view + header->arenaOffset);
+        return true;
+    }
+    
+    std::string_view ArenaText(uint32_t offset, uint32_t length) const {
+        if (offset > header->arenaBytes || length > header->arenaBytes - offset) {
+            return std::string_view();
+        }
+        return std::string_view(arena + offset, length);
+    }
+    
+    void Close() {
+        file.Close();
+        header = nullptr;
+        records = nullptr;
+        arena = nullptr;
+    }
+    
+public:
+    MappedTranscript() = default;
+    MappedTranscript(const MappedTranscript&) = delete;
+    MappedTranscript& operator=(const MappedTranscript&) = delete;
+    
+    ~MappedTranscript() {
+        Close();
+    }
+    
+    bool Open(const std::string& path) {
+        Close();
+        if (!file.Open(path)) {
+            std::cerr << "Error: Failed to open binary transcript: " << path << std::endl;
+            Close();
+            return false;
+        }
+        if (!Validate(path)) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+    
+    size_t Size() const {
+        return header ? static_cast<size_t>(header->segmentCount) : 0;
+    }
+    
+    // Records are recordSize apart, which files written by later versions may make larger
+    const TranscriptSegmentRecord& Segment(size_t index) const {
+        return *reinterpret_cast<const TranscriptSegmentRecord*>(records + index * header->recordSize);
+    }
+    
+    // Text of a segment; empty if its span does not lie in the arena
+    std::string_view Text(size_t index) const {
+        const TranscriptSegmentRecord& segment = Segment(index);
+        return ArenaText(segment.textOffset, segment.textLength);
+    }
+    
+    double StartSeconds(size_t index) const {
+        return static_cast<double>(Segment(index).startSample) / header->sampleRate;
+    }
+    
+    double EndSeconds(size_t index) const {
+        return static_cast<double>(Segment(index).endSample) / header->sampleRate;
+    }
+    
+    uint32_t SampleRate() const {
+        return header->sampleRate;
+    }
+    
+    uint32_t Version() const {
+        return header->version;
+    }
+    
+    int64_t GeneratedAt() const {
+        return header->generatedAt;
+    }
+    
+    std::string_view ModelTier() const {
+        return ArenaText(header->modelTierOffset, header->modelTierLength);
+    }
+};
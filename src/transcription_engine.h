@@ -0,0 +1,2978 @@
+#pragma once
+
+// Transcription engine shared by the transcribe tool and transcribe_bench: model loading,
+// VAD, diarization, speaker linking and the decode pipeline.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <chrono>
+#include <map>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <sstream>
+#include <cstdint>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+// SSE2 is part of x86-64; AVX is used when the compiler targets it (e.g. /arch:AVX2)
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRANSCRIBE_SSE2 1
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "c-api/c-api.h"
+#include "onnxruntime_c_api.h"
+#include "wav_reader.h"
+
+struct SpeakerSegment {
+    float start;
+    float end;
+    int speaker;
+    std::string text;
+};
+
+// Invoked for every segment as soon as it has been decoded
+using SegmentCallback = std::function<void(const SpeakerSegment&)>;
+
+// A diarized speaker turn, in samples. Turns of different speakers may overlap.
+struct SpeakerTurn {
+    int64_t startSample;
+    int64_t endSample;
+    int speaker;
+};
+
+// A span of audio that is decoded exactly once and attributed to one speaker
+struct DecodeRegion {
+    int64_t startSample;
+    int64_t endSample;
+    int speaker;
+};
+
+template <typename Span>
+inline double TotalSeconds(const std::vector<Span>& spans, int sampleRate) {
+    int64_t samples = 0;
+    for (const auto& span : spans) {
+        samples += span.endSample - span.startSample;
+    }
+    return static_cast<double>(samples) / sampleRate;
+}
+
+// Turns the (possibly overlapping) diarization turns into non-overlapping decode regions.
+//
+// The turn boundaries cut the timeline into elementary pieces, each covered by a set of
+// active speakers. Runs of contiguous covered pieces form speech islands; within an island
+// every piece goes to the active speaker with the most speech in that island, and adjacent
+// pieces of the same speaker are merged. ASR work is then proportional to the union of the
+// speech, and overlapped audio is no longer transcribed once per speaker.
+inline std::vector<DecodeRegion> PlanDecodeRegions(const std::vector<SpeakerTurn>& turns) {
+    struct Piece {
+        int64_t start;
+        int64_t end;
+        std::vector<int> speakers;
+    };
+    
+    std::vector<int64_t> boundaries;
+    for (const auto& turn : turns) {
+        if (turn.endSample > turn.startSample) {
+            boundaries.push_back(turn.startSample);
+            boundaries.push_back(turn.endSample);
+        }
+    }
+    std::sort(boundaries.begin(), boundaries.end());
+    boundaries.erase(std::unique(boundaries.begin(), boundaries.end()), boundaries.end());
+    
+    // Sweep the boundaries, keeping the turns sorted by start so each piece only scans
+    // turns that have already started
+    std::vector<SpeakerTurn> sorted = turns;
+    std::sort(sorted.begin(), sorted.end(), [](const SpeakerTurn& a, const SpeakerTurn& b) {
+        return a.startSample < b.startSample;
+    });
+    
+    std::vector<Piece> pieces;
+    std::vector<SpeakerTurn> active;
+    size_t nextTurn = 0;
+    for (size_t b = 0; b + 1 < boundaries.size(); ++b) {
+        int64_t pieceStart = boundaries[b];
+        int64_t pieceEnd = boundaries[b + 1];
+        
+        while (nextTurn < sorted.size() && sorted[nextTurn].startSample <= pieceStart) {
+            if (sorted[nextTurn].endSample > sorted[nextTurn].startSample) {
+                active.push_back(sorted[nextTurn]);
+            }
+            ++nextTurn;
+        }
+        active.erase(std::remove_if(active.begin(), active.end(), [pieceStart](const SpeakerTurn& turn) {
+            return turn.endSample <= pieceStart;
+        }), active.end());
+        
+        if (active.empty()) {
+            continue;
+        }
+        
+        Piece piece;
+        piece.start = pieceStart;
+        piece.end = pieceEnd;
+        for (const auto& turn : active) {
+            if (std::find(piece.speakers.begin(), piece.speakers.end(), turn.speaker) == piece.speakers.end()) {
+                piece.speakers.push_back(turn.speaker);
+            }
+        }
+        pieces.push_back(piece);
+    }
+    
+    std::vector<DecodeRegion> regions;
+    size_t islandBegin = 0;
+    while (islandBegin < pieces.size()) {
+        size_t islandEnd = islandBegin + 1;
+        while (islandEnd < pieces.size() && pieces[islandEnd].start == pieces[islandEnd - 1].end) {
+            ++islandEnd;
+        }
+        
+        // Speech per speaker within this island
+        std::map<int, int64_t> coverage;
+        for (size_t p = islandBegin; p < islandEnd; ++p) {
+            for (int speaker : pieces[p].speakers) {
+                coverage[speaker] += pieces[p].end - pieces[p].start;
+            }
+        }
+        
+        for (size_t p = islandBegin; p < islandEnd; ++p) {
+            int dominant = pieces[p].speakers[0];
+            for (int speaker : pieces[p].speakers) {
+                if (coverage[speaker] > coverage[dominant] ||
+                    (coverage[speaker] == coverage[dominant] && speaker < dominant)) {
+                    dominant = speaker;
+                }
+            }
+            
+            if (!regions.empty() && regions.back().speaker == dominant && regions.back().endSample == pieces[p].start) {
+                regions.back().endSample = pieces[p].end;
+            } else {
+                DecodeRegion region;
+                region.startSample = pieces[p].start;
+                region.endSample = pieces[p].end;
+                region.speaker = dominant;
+                regions.push_back(region);
+            }
+        }
+        
+        islandBegin = islandEnd;
+    }
+    
+    return regions;
+}
+
+// Merges consecutive regions of the same speaker separated by less than maxGapSamples,
+// as long as the merged region stays within maxSamples (0 = no limit). Every region saved
+// is one less stream creation and preprocess/encode/decode setup, and the model gets more
+// context. The gap audio is decoded along with the speech around it.
+inline std::vector<DecodeRegion> CoalesceRegions(const std::vector<DecodeRegion>& regions, int64_t maxGapSamples, int64_t maxSamples) {
+    std::vector<DecodeRegion> merged;
+    for (const auto& region : regions) {
+        if (!merged.empty()) {
+            DecodeRegion& last = merged.back();
+            bool sameSpeaker = last.speaker == region.speaker;
+            bool closeEnough = region.startSample - last.endSample < maxGapSamples;
+            bool fits = maxSamples <= 0 || region.endSample - last.startSample <= maxSamples;
+            if (sameSpeaker && closeEnough && fits) {
+                last.endSample = region.endSample;
+                continue;
+            }
+        }
+        merged.push_back(region);
+    }
+    return merged;
+}
+
+// Cuts [start, end) into pieces of at most maxSamples. Each cut is placed at the quietest
+// 20 ms frame within the last two seconds (at most half the limit) before the limit, so
+// words are rarely split. Only the search windows are read from the audio.
+inline std::vector<std::pair<int64_t, int64_t>> SplitAtQuietPoints(const AudioSource& audio, int64_t start, int64_t end, int64_t maxSamples) {
+    const int64_t frameSamples = 320;
+    const int64_t hopSamples = 160;
+    
+    std::vector<std::pair<int64_t, int64_t>> pieces;
+    if (maxSamples <= 0) {
+        pieces.emplace_back(start, end);
+        return pieces;
+    }
+    
+    int64_t searchSamples = std::min<int64_t>(2 * 16000, maxSamples / 2);
+    std::vector<float> window;
+    int64_t cursor = start;
+    while (end - cursor > maxSamples) {
+        int64_t limit = cursor + maxSamples;
+        int64_t bestCut = limit;
+        double bestEnergy = -1.0;
+        int64_t windowStart = limit - searchSamples;
+        const float* samples = audio.Span(windowStart, limit, window);
+        for (int64_t frame = windowStart; frame + frameSamples <= limit; frame += hopSamples) {
+            double energy = 0.0;
+            for (int64_t k = frame - windowStart; k < frame - windowStart + frameSamples; ++k) {
+                energy += samples[k] * samples[k];
+            }
+            if (bestEnergy < 0.0 || energy < bestEnergy) {
+                bestEnergy = energy;
+                bestCut = frame + frameSamples / 2;
+            }
+        }
+        pieces.emplace_back(cursor, bestCut);
+        cursor = bestCut;
+    }
+    pieces.emplace_back(cursor, end);
+    return pieces;
+}
+
+// Appends the text of a following piece, keeping exactly one space between them
+inline std::string JoinText(const std::string& first, const std::string& second) {
+    if (first.empty()) {
+        return second;
+    }
+    if (second.empty()) {
+        return first;
+    }
+    if (first.back() == ' ' || second.front() == ' ') {
+        return first + second;
+    }
+    return first + " " + second;
+}
+
+// Runs body(0) .. body(count - 1) on up to `workers` threads (0 = one per core)
+inline void ParallelFor(size_t count, int workers, const std::function<void(size_t)>& body) {
+    size_t numThreads = workers > 0 ? static_cast<size_t>(workers) : std::max(1u, std::thread::hardware_concurrency());
+    numThreads = std::min(numThreads, count);
+    if (numThreads <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            body(i);
+        }
+        return;
+    }
+    
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < numThreads; ++t) {
+        threads.emplace_back([&] {
+            for (size_t i = next++; i < count; i = next++) {
+                body(i);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// Queue between pipeline stages. Push blocks while the queue is full, so a fast producer
+// cannot run ahead of its consumers by more than `capacity` items.
+template <typename T>
+class BoundedQueue {
+private:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(std::max<size_t>(1, capacity)) {}
+    
+    void Push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&] { return items.size() < capacity || closed; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+    
+    // Waits for the next item; false once the queue is closed and drained
+    bool Pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&] { return !items.empty() || closed; });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+    
+    // No more items will be pushed
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+};
+
+// Restricts turns to [start, end), dropping the ones that fall outside
+inline std::vector<SpeakerTurn> ClipTurns(const std::vector<SpeakerTurn>& turns, int64_t start, int64_t end) {
+    std::vector<SpeakerTurn> clipped;
+    for (auto turn : turns) {
+        turn.startSample = std::max(turn.startSample, start);
+        turn.endSample = std::min(turn.endSample, end);
+        if (turn.endSample > turn.startSample) {
+            clipped.push_back(turn);
+        }
+    }
+    return clipped;
+}
+
+// How planned regions are turned into recognizer calls
+struct DecodeSettings {
+    // Moonshine's cost grows faster than linearly with input length, so longer regions are
+    // split; 15 s keeps each call near the flat part of the curve (see --bench-decode)
+    float maxSegmentSeconds = 15.0f;
+    int workers = 0;  // Concurrent decode calls per file, 0 = one per core
+    // Consecutive regions of the same speaker closer than this are decoded as one
+    float mergeGapSeconds = 0.5f;
+    std::string asrModel;  // ASR model directory to decode with; empty = the engine's main model
+    // Decode with the fast model first and only re-decode segments it is unsure about
+    bool cascade = false;
+    float cascadeThreshold = 0.5f;  // Min confidence (0-1) to keep the fast model's text
+};
+
+// Mean token log-probability from a recognizer result's JSON, for models that report them
+// ("ys_log_probs"); false if the result has none. sherpa-onnx's offline Moonshine results,
+// which are all this tool ships with, do not include it, so for them the cascade always
+// falls back to HeuristicConfidence.
+inline bool MeanTokenLogProb(const char* json, float& meanLogProb) {
+    const char* key = json ? std::strstr(json, "\"ys_log_probs\"") : nullptr;
+    const char* values = key ? std::strchr(key, '[') : nullptr;
+    if (!values) {
+        return false;
+    }
+    double sum = 0.0;
+    int count = 0;
+    const char* p = values + 1;
+    while (*p && *p != ']') {
+        char* end = nullptr;
+        double value = std::strtod(p, &end);
+        if (end == p) {
+            ++p;
+            continue;
+        }
+        sum += value;
+        ++count;
+        p = end;
+    }
+    if (count == 0) {
+        return false;
+    }
+    meanLogProb = static_cast<float>(sum / count);
+    return true;
+}
+
+// Confidence (0-1) in a transcript of a span of speech, for recognizers without token
+// probabilities. Small models fail in two recognizable ways: they drop words (far too few
+// words for the duration) and they loop (far too many words, or the same words over and
+// over). A span without any words is trusted however long it is: the VAD and the diarizer
+// also pass on coughs, laughter and music, which the main model has no words for either.
+inline float HeuristicConfidence(const std::string& text, float seconds) {
+    std::vector<std::string> words;
+    std::istringstream stream(text);
+    std::string word;
+    while (stream >> word) {
+        std::transform(word.begin(), word.end(), word.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        words.push_back(word);
+    }
+    if (words.empty()) {
+        return 1.0f;
+    }
+    
+    // Conversational speech runs at about 2-3 words per second
+    float rate = words.size() / std::max(seconds, 0.1f);
+    float rateScore = 1.0f;
+    if (rate > 4.5f) {
+        rateScore = std::max(0.0f, 1.0f - (rate - 4.5f) / 4.5f);
+    } else if (rate < 0.8f && seconds >= 3.0f) {
+        rateScore = rate / 0.8f;
+    }
+    
+    float repetitionScore = 1.0f;
+    if (words.size() >= 8) {
+        std::vector<std::string> distinct = words;
+        std::sort(distinct.begin(), distinct.end());
+        float uniqueRatio = static_cast<float>(std::unique(distinct.begin(), distinct.end()) - distinct.begin()) / words.size();
+        repetitionScore = std::min(1.0f, uniqueRatio / 0.5f);
+    }
+    return std::min(rateScore, repetitionScore);
+}
+
+// Dot products of a with b, a with a and b with b, in one pass over both vectors
+inline void DotProducts(const float* a, const float* b, size_t dim, float& ab, float& aa, float& bb) {
+    size_t i = 0;
+    ab = 0.0f;
+    aa = 0.0f;
+    bb = 0.0f;
+#if defined(__AVX__)
+    __m256 sumAB = _mm256_setzero_ps();
+    __m256 sumAA = _mm256_setzero_ps();
+    __m256 sumBB = _mm256_setzero_ps();
+    for (; i + 8 <= dim; i += 8) {
+        __m256 va = _mm256_loadu_ps(a + i);
+        __m256 vb = _mm256_loadu_ps(b + i);
+        sumAB = _mm256_add_ps(sumAB, _mm256_mul_ps(va, vb));
+        sumAA = _mm256_add_ps(sumAA, _mm256_mul_ps(va, va));
+        sumBB = _mm256_add_ps(sumBB, _mm256_mul_ps(vb, vb));
+    }
+    alignas(32) float lanes[3][8];
+    _mm256_store_ps(lanes[0], sumAB);
+    _mm256_store_ps(lanes[1], sumAA);
+    _mm256_store_ps(lanes[2], sumBB);
+    for (int lane = 0; lane < 8; ++lane) {
+        ab += lanes[0][lane];
+        aa += lanes[1][lane];
+        bb += lanes[2][lane];
+    }
+#elif defined(TRANSCRIBE_SSE2)
+    __m128 sumAB = _mm_setzero_ps();
+    __m128 sumAA = _mm_setzero_ps();
+    __m128 sumBB = _mm_setzero_ps();
+    for (; i + 4 <= dim; i += 4) {
+        __m128 va = _mm_loadu_ps(a + i);
+        __m128 vb = _mm_loadu_ps(b + i);
+        sumAB = _mm_add_ps(sumAB, _mm_mul_ps(va, vb));
+        sumAA = _mm_add_ps(sumAA, _mm_mul_ps(va, va));
+        sumBB = _mm_add_ps(sumBB, _mm_mul_ps(vb, vb));
+    }
+    alignas(16) float lanes[3][4];
+    _mm_store_ps(lanes[0], sumAB);
+    _mm_store_ps(lanes[1], sumAA);
+    _mm_store_ps(lanes[2], sumBB);
+    for (int lane = 0; lane < 4; ++lane) {
+        ab += lanes[0][lane];
+        aa += lanes[1][lane];
+        bb += lanes[2][lane];
+    }
+#endif
+    for (; i < dim; ++i) {
+        ab += a[i] * b[i];
+        aa += a[i] * a[i];
+        bb += b[i] * b[i];
+    }
+}
+
+inline float DotProduct(const float* a, const float* b, size_t dim) {
+    size_t i = 0;
+    float sum = 0.0f;
+#if defined(__AVX__)
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    for (; i + 16 <= dim; i += 16) {
+        sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+    }
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, _mm256_add_ps(sum0, sum1));
+    for (int lane = 0; lane < 8; ++lane) {
+        sum += lanes[lane];
+    }
+#elif defined(TRANSCRIBE_SSE2)
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    for (; i + 8 <= dim; i += 8) {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, _mm_add_ps(sum0, sum1));
+    for (int lane = 0; lane < 4; ++lane) {
+        sum += lanes[lane];
+    }
+#endif
+    for (; i < dim; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+inline float CosineSimilarity(const float* a, const float* b, size_t dim) {
+    float dot, normA, normB;
+    DotProducts(a, b, dim, dot, normA, normB);
+    if (normA <= 0.0f || normB <= 0.0f) {
+        return 0.0f;
+    }
+    return dot / (std::sqrt(normA) * std::sqrt(normB));
+}
+
+// Sum of squares and largest magnitude of n 16-bit samples, accumulated into the arguments
+inline void ScanInt16Levels(const uint8_t* data, size_t n, double& sumSquares, int& peak) {
+    size_t i = 0;
+    int32_t high = 0, low = 0;
+#if defined(__AVX__) || defined(TRANSCRIBE_SSE2)
+    // madd's pair sums reach 2^31 for two -32768 samples, so lanes are widened as unsigned
+    __m128i sum = _mm_setzero_si128();
+    __m128i zero = _mm_setzero_si128();
+    __m128i maxima = _mm_set1_epi16(0);
+    __m128i minima = _mm_set1_epi16(0);
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 2 * i));
+        __m128i squares = _mm_madd_epi16(v, v);
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(squares, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(squares, zero));
+        maxima = _mm_max_epi16(maxima, v);
+        minima = _mm_min_epi16(minima, v);
+    }
+    alignas(16) uint64_t sums[2];
+    alignas(16) int16_t highs[8], lows[8];
+    _mm_store_si128(reinterpret_cast<__m128i*>(sums), sum);
+    _mm_store_si128(reinterpret_cast<__m128i*>(highs), maxima);
+    _mm_store_si128(reinterpret_cast<__m128i*>(lows), minima);
+    sumSquares += static_cast<double>(sums[0]) + static_cast<double>(sums[1]);
+    for (int lane = 0; lane < 8; ++lane) {
+        high = std::max<int32_t>(high, highs[lane]);
+        low = std::min<int32_t>(low, lows[lane]);
+    }
+#endif
+    for (; i < n; ++i) {
+        int32_t v = static_cast<int16_t>(data[2 * i] | (data[2 * i + 1] << 8));
+        sumSquares += static_cast<double>(v * v);
+        high = std::max(high, v);
+        low = std::min(low, v);
+    }
+    peak = std::max(peak, std::max(high, -low));
+}
+
+// Largest magnitude of n float samples
+inline float PeakMagnitude(const float* samples, size_t n) {
+    size_t i = 0;
+    float peak = 0.0f;
+#if defined(__AVX__) || defined(TRANSCRIBE_SSE2)
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 maxima = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        maxima = _mm_max_ps(maxima, _mm_andnot_ps(signMask, _mm_loadu_ps(samples + i)));
+    }
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, maxima);
+    for (int lane = 0; lane < 4; ++lane) {
+        peak = std::max(peak, lanes[lane]);
+    }
+#endif
+    for (; i < n; ++i) {
+        peak = std::max(peak, std::abs(samples[i]));
+    }
+    return peak;
+}
+
+// Level of a whole track in dBFS (-inf for digital silence)
+struct TrackLevels {
+    double rmsDb = -std::numeric_limits<double>::infinity();
+    double peakDb = -std::numeric_limits<double>::infinity();
+};
+
+// Scans the whole track straight from the mapping. 16-bit PCM, which the recorder writes, is
+// scanned in its raw form over all channels; other encodings are converted to mono first.
+inline TrackLevels ScanLevels(const WavReader& wav) {
+    double sumSquares = 0.0;
+    double peak = 0.0;
+    uint64_t count = 0;
+    if (wav.BitsPerSample() == 16 && !wav.IsFloat()) {
+        int peak16 = 0;
+        count = wav.DataBytes() / 2;
+        ScanInt16Levels(wav.Data(), static_cast<size_t>(count), sumSquares, peak16);
+        sumSquares /= 32768.0 * 32768.0;
+        peak = peak16 / 32768.0;
+    } else {
+        const int64_t kBlockSamples = 64 * 1024;
+        std::vector<float> block;
+        for (int64_t start = 0; start < wav.NumSamples(); start += kBlockSamples) {
+            const float* samples = wav.Span(start, start + kBlockSamples, block);
+            sumSquares += DotProduct(samples, samples, block.size());
+            peak = std::max<double>(peak, PeakMagnitude(samples, block.size()));
+        }
+        count = static_cast<uint64_t>(wav.NumSamples());
+    }
+    
+    TrackLevels levels;
+    if (count > 0 && sumSquares > 0.0) {
+        levels.rmsDb = 10.0 * std::log10(sumSquares / count);
+    }
+    if (peak > 0.0) {
+        levels.peakDb = 20.0 * std::log10(peak);
+    }
+    return levels;
+}
+
+// Tracks that stay below both levels contain nothing worth transcribing and are skipped
+// before any model runs. A few seconds of speech in an hour of silence barely move the RMS,
+// so the peak has to stay low as well.
+struct SilenceSettings {
+    bool enabled = true;
+    float maxRmsDb = -60.0f;
+    float maxPeakDb = -40.0f;
+};
+
+inline bool IsSilent(const TrackLevels& levels, const SilenceSettings& settings) {
+    return levels.rmsDb < settings.maxRmsDb && levels.peakDb < settings.maxPeakDb;
+}
+
+// Average-linkage agglomerative clustering of embeddings by cosine similarity, stopping once
+// no two clusters are at least `threshold` similar. Embeddings that share a group (e.g. two
+// speakers that diarization already separated within one file) are never put in the same
+// cluster; pass -1 for no group. Returns a cluster label per embedding, numbered in order of
+// first appearance.
+//
+// Uses the nearest-neighbour chain algorithm, which is O(n^2) for average linkage, so a few
+// thousand embeddings cluster in milliseconds.
+inline std::vector<int> ClusterEmbeddings(const std::vector<std::vector<float>>& embeddings, const std::vector<int>& groups,
+                                   float threshold) {
+    const float kCannotLink = -std::numeric_limits<float>::infinity();
+    size_t n = embeddings.size();
+    size_t dim = n > 0 ? embeddings[0].size() : 0;
+    
+    // Unit-length copies, so cosine similarity is a plain dot product
+    std::vector<float> normalized(n * dim, 0.0f);
+    for (size_t i = 0; i < n; ++i) {
+        float norm = std::sqrt(DotProduct(embeddings[i].data(), embeddings[i].data(), dim));
+        for (size_t d = 0; norm > 0.0f && d < dim; ++d) {
+            normalized[i * dim + d] = embeddings[i][d] / norm;
+        }
+    }
+    
+    std::vector<float> similarity(n * n, 0.0f);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = i + 1; j < n; ++j) {
+            similarity[i * n + j] = (groups[i] >= 0 && groups[i] == groups[j]) ? kCannotLink
+                : DotProduct(&normalized[i * dim], &normalized[j * dim], dim);
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < i; ++j) {
+            similarity[i * n + j] = similarity[j * n + i];
+        }
+    }
+    
+    // Each cluster is represented by one of its members; parent links point merged
+    // representatives at the cluster that absorbed them
+    std::vector<size_t> size(n, 1);
+    std::vector<size_t> parent(n);
+    std::vector<bool> active(n, true);
+    for (size_t i = 0; i < n; ++i) {
+        parent[i] = i;
+    }
+    
+    std::vector<size_t> chain;
+    size_t remaining = n;
+    while (remaining > 1) {
+        if (chain.empty()) {
+            size_t first = 0;
+            while (!active[first]) {
+                ++first;
+            }
+            chain.push_back(first);
+        }
+        
+        size_t current = chain.back();
+        size_t previous = chain.size() > 1 ? chain[chain.size() - 2] : n;
+        
+        // Most similar active cluster, preferring the previous chain link on ties
+        size_t best = previous;
+        float bestSimilarity = previous < n ? similarity[current * n + previous] : kCannotLink;
+        for (size_t other = 0; other < n; ++other) {
+            if (active[other] && other != current && similarity[current * n + other] > bestSimilarity) {
+                best = other;
+                bestSimilarity = similarity[current * n + other];
+            }
+        }
+        
+        if (best >= n || bestSimilarity < threshold) {
+            // Nothing is similar enough, and merges elsewhere can only lower the similarity
+            // to this cluster, so it is final
+            active[current] = false;
+            --remaining;
+            chain.pop_back();
+            continue;
+        }
+        
+        if (best != previous) {
+            chain.push_back(best);
+            continue;
+        }
+        
+        // current and previous are mutual nearest neighbours: merge previous into current
+        chain.pop_back();
+        chain.pop_back();
+        for (size_t other = 0; other < n; ++other) {
+            if (!active[other] || other == current || other == previous) {
+                continue;
+            }
+            float a = similarity[current * n + other];
+            float b = similarity[previous * n + other];
+            float merged = (a == kCannotLink || b == kCannotLink) ? kCannotLink
+                : (a * size[current] + b * size[previous]) / (size[current] + size[previous]);
+            similarity[current * n + other] = merged;
+            similarity[other * n + current] = merged;
+        }
+        size[current] += size[previous];
+        parent[previous] = current;
+        active[previous] = false;
+        --remaining;
+    }
+    
+    std::vector<int> labels(n, -1);
+    std::map<size_t, int> clusterLabels;
+    for (size_t i = 0; i < n; ++i) {
+        size_t root = i;
+        while (parent[root] != root) {
+            root = parent[root];
+        }
+        auto it = clusterLabels.find(root);
+        if (it == clusterLabels.end()) {
+            it = clusterLabels.emplace(root, static_cast<int>(clusterLabels.size())).first;
+        }
+        labels[i] = it->second;
+    }
+    return labels;
+}
+
+// How long recordings are split up for diarization
+struct DiarizationSettings {
+    float chunkSeconds = 600.0f;        // 0 = diarize the whole file at once
+    float chunkOverlapSeconds = 15.0f;  // Context shared by neighbouring chunks
+    float linkThreshold = 0.5f;         // Min cosine similarity to treat two chunk speakers as the same person
+};
+
+// Keeps speaker identities consistent across diarization chunks. Every chunk speaker is
+// matched to the most similar known speaker (one-to-one, best pairs first) if their
+// centroids are similar enough, and becomes a new speaker otherwise.
+class SpeakerLinker {
+private:
+    std::vector<std::vector<float>> centroids;  // Running sums, indexed by global speaker ID
+    float threshold;
+    int numSpeakers;
+    
+public:
+    explicit SpeakerLinker(float similarityThreshold) : threshold(similarityThreshold), numSpeakers(0) {}
+    
+    std::map<int, int> Link(const std::map<int, std::vector<float>>& localCentroids) {
+        struct Candidate {
+            float similarity;
+            int local;
+            size_t global;
+        };
+        
+        std::vector<Candidate> candidates;
+        for (const auto& local : localCentroids) {
+            for (size_t g = 0; g < centroids.size(); ++g) {
+                if (centroids[g].empty()) {
+                    continue;
+                }
+                float similarity = CosineSimilarity(local.second.data(), centroids[g].data(), centroids[g].size());
+                if (similarity >= threshold) {
+                    candidates.push_back({similarity, local.first, g});
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+            return a.similarity > b.similarity;
+        });
+        
+        std::map<int, int> mapping;
+        std::vector<bool> globalTaken(centroids.size(), false);
+        for (const auto& candidate : candidates) {
+            if (mapping.count(candidate.local) || globalTaken[candidate.global]) {
+                continue;
+            }
+            mapping[candidate.local] = static_cast<int>(candidate.global);
+            globalTaken[candidate.global] = true;
+        }
+        
+        for (const auto& local : localCentroids) {
+            auto it = mapping.find(local.first);
+            if (it == mapping.end()) {
+                mapping[local.first] = numSpeakers++;
+                centroids.push_back(local.second);
+            } else {
+                std::vector<float>& centroid = centroids[it->second];
+                for (size_t d = 0; d < centroid.size(); ++d) {
+                    centroid[d] += local.second[d];
+                }
+            }
+        }
+        return mapping;
+    }
+    
+    // Speakers without a centroid (too little speech to embed) cannot be linked and always
+    // become new speakers
+    int NewSpeaker() {
+        centroids.emplace_back();
+        return numSpeakers++;
+    }
+    
+    // Centroid sums by global speaker ID (empty for speakers without one), to save and restore the linker
+    const std::vector<std::vector<float>>& Centroids() const {
+        return centroids;
+    }
+    
+    void Restore(const std::vector<std::vector<float>>& savedCentroids) {
+        centroids = savedCentroids;
+        numSpeakers = static_cast<int>(centroids.size());
+    }
+};
+
+// Append-only record of the work finished on one file, so a transcription that crashes or is
+// preempted resumes where it stopped instead of starting over. Every decoded region is
+// appended and flushed as soon as it is reported, in region order, and chunked diarization
+// also appends the speaker linker state after each chunk. Entries only count for the audio
+// and settings of the key they were written under, and for the same pass (e.g. "diarize").
+class SegmentJournal {
+private:
+    struct Region {
+        int64_t chunk;
+        SpeakerSegment segment;
+    };
+    
+    // What one pass (diarize, vad, ...) has journaled. A file may go through several passes,
+    // e.g. diarization that finds nothing and then the VAD fallback, so each keeps its own.
+    struct Progress {
+        std::vector<Region> regions;
+        int64_t chunksDone = 0;
+        std::vector<std::vector<float>> linkerCentroids;  // As of the last finished chunk
+        bool complete = false;
+    };
+    
+    std::string path;
+    std::string key;
+    std::string pass;
+    std::map<std::string, Progress> passes;
+    std::ofstream out;
+    std::mutex mutex;
+    
+    Progress& Current() {
+        return passes[pass];
+    }
+    
+    const Progress& Current() const {
+        static const Progress none;
+        auto it = passes.find(pass);
+        return it == passes.end() ? none : it->second;
+    }
+    
+    static std::string Escape(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            switch (c) {
+                case '\\': escaped += "\\\\"; break;
+                case '\t': escaped += "\\t"; break;
+                case '\n': escaped += "\\n"; break;
+                case '\r': escaped += "\\r"; break;
+                default: escaped += c;
+            }
+        }
+        return escaped;
+    }
+    
+    static std::string Unescape(const std::string& text) {
+        std::string plain;
+        for (size_t i = 0; i < text.size(); ++i) {
+            if (text[i] != '\\' || i + 1 == text.size()) {
+                plain += text[i];
+                continue;
+            }
+            char c = text[++i];
+            plain += c == 't' ? '\t' : c == 'n' ? '\n' : c == 'r' ? '\r' : c;
+        }
+        return plain;
+    }
+    
+    static std::vector<std::string> Split(const std::string& line, char separator) {
+        std::vector<std::string> fields;
+        size_t begin = 0;
+        while (true) {
+            size_t end = line.find(separator, begin);
+            fields.push_back(line.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+            if (end == std::string::npos) {
+                return fields;
+            }
+            begin = end + 1;
+        }
+    }
+    
+    // Applies one record; false for anything malformed
+    bool Apply(const std::string& line) {
+        std::vector<std::string> fields = Split(line, '\t');
+        if (fields[0] == "pass" && fields.size() == 2) {
+            pass = fields[1];
+            Current();
+        } else if (fields[0] == "region" && fields.size() == 6) {
+            Region region;
+            region.chunk = std::atoll(fields[1].c_str());
+            region.segment.start = std::strtof(fields[2].c_str(), nullptr);
+            region.segment.end = std::strtof(fields[3].c_str(), nullptr);
+            region.segment.speaker = std::atoi(fields[4].c_str());
+            region.segment.text = Unescape(fields[5]);
+            Current().regions.push_back(region);
+        } else if (fields[0] == "chunk" && fields.size() >= 3) {
+            Progress& progress = Current();
+            progress.chunksDone = std::atoll(fields[1].c_str()) + 1;
+            std::vector<std::vector<float>>& linkerCentroids = progress.linkerCentroids;
+            linkerCentroids.clear();
+            for (size_t f = 3; f < fields.size(); ++f) {
+                std::vector<float> centroid;
+                if (!fields[f].empty()) {
+                    for (const auto& value : Split(fields[f], ',')) {
+                        centroid.push_back(std::strtof(value.c_str(), nullptr));
+                    }
+                }
+                linkerCentroids.push_back(centroid);
+            }
+            if (linkerCentroids.size() != static_cast<size_t>(std::atoll(fields[2].c_str()))) {
+                return false;
+            }
+        } else if (fields[0] == "done" && fields.size() == 1) {
+            Current().complete = true;
+        } else {
+            return false;
+        }
+        return true;
+    }
+    
+    // Writes the journal from scratch with the records kept so far, then keeps appending to it
+    bool Rewrite() {
+        out.close();
+        std::filesystem::path temporary = path + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::trunc);
+            file << "transcribe-journal 1\t" << key << '\n';
+            for (const auto& entry : passes) {
+                if (entry.first == pass) {
+                    continue;
+                }
+                WritePass(file, entry.first, entry.second);
+            }
+            // The current pass goes last, so that records appended from here on belong to it
+            if (!pass.empty()) {
+                WritePass(file, pass, Current());
+            }
+            if (!file.flush()) {
+                std::cerr << "Warning: Failed to write journal " << temporary.string() << ", progress will not be kept" << std::endl;
+                return false;
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(temporary, path, ec);
+        out.open(path, std::ios::app);
+        return !ec && out.is_open();
+    }
+    
+    static void WritePass(std::ostream& file, const std::string& name, const Progress& progress) {
+        file << "pass\t" << name << '\n';
+        for (const auto& region : progress.regions) {
+            WriteRegion(file, region.chunk, region.segment);
+        }
+        if (progress.chunksDone > 0) {
+            WriteChunk(file, progress.chunksDone - 1, progress.linkerCentroids);
+        }
+        if (progress.complete) {
+            file << "done\n";
+        }
+    }
+    
+    static void WriteRegion(std::ostream& file, int64_t chunk, const SpeakerSegment& segment) {
+        file << "region\t" << chunk << '\t' << std::setprecision(9) << segment.start << '\t' << segment.end
+             << std::setprecision(6) << '\t' << segment.speaker << '\t' << Escape(segment.text) << '\n';
+    }
+    
+    static void WriteChunk(std::ostream& file, int64_t chunk, const std::vector<std::vector<float>>& centroids) {
+        file << "chunk\t" << chunk << '\t' << centroids.size() << std::setprecision(9);
+        for (const auto& centroid : centroids) {
+            file << '\t';
+            for (size_t d = 0; d < centroid.size(); ++d) {
+                file << (d > 0 ? "," : "") << centroid[d];
+            }
+        }
+        file << std::setprecision(6) << '\n';
+    }
+    
+public:
+    // Loads what an earlier run journaled under the same key; a journal of other audio or
+    // settings, and a record torn by a crash, are dropped
+    bool Open(const std::string& journalPath, const std::string& journalKey) {
+        path = journalPath;
+        key = journalKey;
+        std::ifstream file(path, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        file.close();
+        
+        // Only newline-terminated records were written completely
+        std::vector<std::string> lines = Split(data, '\n');
+        lines.pop_back();
+        if (!lines.empty() && lines[0] == "transcribe-journal 1\t" + key) {
+            for (size_t i = 1; i < lines.size() && Apply(lines[i]); ++i) {
+            }
+        }
+        return Rewrite();
+    }
+    
+    // Selects the pass about to run; what was journaled for other passes is kept
+    void Start(const std::string& passName) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (passName != pass) {
+            pass = passName;
+            Current();
+            out << "pass\t" << pass << '\n';
+            out.flush();
+        }
+    }
+    
+    // Whether the pass ran to the end; nothing needs to be recomputed
+    bool Complete() const {
+        return Current().complete;
+    }
+    
+    // Regions journaled for a chunk, in region order, including those whose text is empty
+    std::vector<SpeakerSegment> Regions(int64_t chunk) const {
+        std::vector<SpeakerSegment> segments;
+        for (const auto& region : Current().regions) {
+            if (region.chunk == chunk) {
+                segments.push_back(region.segment);
+            }
+        }
+        return segments;
+    }
+    
+    // Number of leading chunks that are finished, and the speaker linker state after the last one
+    int64_t ChunksDone() const {
+        return Current().chunksDone;
+    }
+    
+    const std::vector<std::vector<float>>& LinkerCentroids() const {
+        return Current().linkerCentroids;
+    }
+    
+    void AddRegion(int64_t chunk, const SpeakerSegment& segment) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Current().regions.push_back({chunk, segment});
+        WriteRegion(out, chunk, segment);
+        out.flush();
+    }
+    
+    void AddChunk(int64_t chunk, const std::vector<std::vector<float>>& centroids) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Current().chunksDone = chunk + 1;
+        Current().linkerCentroids = centroids;
+        WriteChunk(out, chunk, centroids);
+        out.flush();
+    }
+    
+    void Finish() {
+        std::lock_guard<std::mutex> lock(mutex);
+        Current().complete = true;
+        out << "done\n";
+        out.flush();
+    }
+    
+    const std::string& Path() const {
+        return path;
+    }
+};
+
+// Short name of the instruction set extensions ONNX Runtime picks kernels by, e.g. "x86-avx2-fma"
+inline std::string CpuFeatureKey() {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    bool avx, fma, avx2, avx512, vnni;
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    avx = (info[2] & (1 << 28)) != 0;
+    fma = (info[2] & (1 << 12)) != 0;
+    __cpuidex(info, 7, 0);
+    avx2 = (info[1] & (1 << 5)) != 0;
+    avx512 = (info[1] & (1 << 16)) != 0;
+    vnni = (info[2] & (1 << 11)) != 0;
+#else
+    __builtin_cpu_init();
+    avx = __builtin_cpu_supports("avx");
+    fma = __builtin_cpu_supports("fma");
+    avx2 = __builtin_cpu_supports("avx2");
+    avx512 = __builtin_cpu_supports("avx512f");
+    vnni = __builtin_cpu_supports("avx512vnni");
+#endif
+    std::string key = "x86";
+    key += avx512 ? "-avx512" : avx2 ? "-avx2" : avx ? "-avx" : "-sse";
+    key += fma ? "-fma" : "";
+    key += vnni ? "-vnni" : "";
+    return key;
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    return "arm64";
+#else
+    return "generic";
+#endif
+}
+
+// Optimized copies of the models are written next to the originals as
+// <name>.opt-<ONNX Runtime version>-<CPU features>.onnx, since the graph ONNX Runtime
+// produces depends on both
+inline const std::string& OptimizedModelSuffix() {
+    static const std::string suffix = std::string(".opt-") + OrtGetApiBase()->GetVersionString() + "-" + CpuFeatureKey() + ".onnx";
+    return suffix;
+}
+
+// True for optimized model copies (and their temporary files), which are derived from the
+// originals and so are not part of a model's identity
+inline bool IsOptimizedModelFile(const std::filesystem::path& path) {
+    return path.filename().string().find(".opt-") != std::string::npos;
+}
+
+// Cold-start breakdown of TranscriptionEngine::Initialize, in milliseconds
+struct StartupTimings {
+    double fileCheckMs = 0.0;
+    double recognizerMs = 0.0;
+    double fastRecognizerMs = 0.0;
+    double vadMs = 0.0;
+    double diarizationMs = 0.0;
+    double embeddingExtractorMs = 0.0;
+    double warmUpMs = 0.0;
+    double totalMs = 0.0;
+    std::atomic<int> optimizedModelsReused{0};
+    std::atomic<int> optimizedModelsWritten{0};
+    std::atomic<double> firstAsrInferenceMs{-1.0};
+    std::atomic<double> firstDiarizationInferenceMs{-1.0};
+};
+
+// CPU time consumed by the whole process so far (all threads), in milliseconds
+inline double ProcessCpuMs() {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        return 0.0;
+    }
+    auto ticks = [](const FILETIME& time) {
+        return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    };
+    return (ticks(kernel) + ticks(user)) / 10000.0;
+#else
+    timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+#endif
+}
+
+// CPU time consumed by the calling thread so far, in milliseconds
+inline double ThreadCpuMs() {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+        return 0.0;
+    }
+    auto ticks = [](const FILETIME& time) {
+        return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    };
+    return (ticks(kernel) + ticks(user)) / 10000.0;
+#else
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+#endif
+}
+
+// High-water mark of the process's resident memory, in megabytes
+inline double PeakRssMb() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0.0;
+    }
+    return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+    return usage.ru_maxrss / 1024.0;
+#endif
+#endif
+}
+
+// The process's resident memory right now, in megabytes
+inline double CurrentRssMb() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0.0;
+    }
+    return counters.WorkingSetSize / (1024.0 * 1024.0);
+#elif defined(__linux__)
+    // Second field of statm is the resident set, in pages
+    std::ifstream statm("/proc/self/statm");
+    long pages = 0, resident = 0;
+    if (!(statm >> pages >> resident)) {
+        return 0.0;
+    }
+    return resident * static_cast<double>(sysconf(_SC_PAGESIZE)) / (1024.0 * 1024.0);
+#else
+    return PeakRssMb();
+#endif
+}
+
+inline unsigned long CurrentProcessId() {
+#ifdef _WIN32
+    return static_cast<unsigned long>(GetCurrentProcessId());
+#else
+    return static_cast<unsigned long>(getpid());
+#endif
+}
+
+inline std::string JsonEscape(const std::string& value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// Where the time goes for one file (or for the recording as a whole). Stages are timed by
+// wall clock and by process CPU time, so CPU time includes whatever else the process was
+// doing at the time (other decode workers, other daemon jobs). Safe to update from several
+// threads.
+class StageStats {
+private:
+    struct Stage {
+        std::string name;
+        int calls = 0;
+        double wallMs = 0.0;
+        double cpuMs = 0.0;
+        double peakRssMb = 0.0;  // Process high-water mark when the stage last finished
+    };
+    
+    mutable std::mutex mutex;
+    std::string label;
+    double audioSeconds;
+    std::vector<Stage> stages;           // In order of first use
+    std::vector<double> asrCallMs;       // Latency of every recognizer call
+    int cascadeSegments = 0;             // Spans decoded by the fast model in cascade mode
+    int cascadeRedecoded = 0;            // Of those, spans re-decoded by the main model
+    
+    Stage& Find(const std::string& name) {
+        for (auto& stage : stages) {
+            if (stage.name == name) {
+                return stage;
+            }
+        }
+        stages.push_back(Stage());
+        stages.back().name = name;
+        return stages.back();
+    }
+    
+    static double Percentile(std::vector<double> values, double fraction) {
+        if (values.empty()) {
+            return 0.0;
+        }
+        size_t index = static_cast<size_t>(fraction * (values.size() - 1) + 0.5);
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+        return values[index];
+    }
+    
+public:
+    // Upper bounds of the ASR latency histogram buckets, in milliseconds
+    static std::vector<double> HistogramBounds() {
+        return {50, 100, 200, 500, 1000, 2000, 5000};
+    }
+    
+    explicit StageStats(const std::string& statsLabel) : label(statsLabel), audioSeconds(0.0) {}
+    
+    void SetAudioSeconds(double seconds) {
+        std::lock_guard<std::mutex> lock(mutex);
+        audioSeconds = seconds;
+    }
+    
+    void Record(const std::string& name, double wallMs, double cpuMs) {
+        double peakRss = PeakRssMb();
+        std::lock_guard<std::mutex> lock(mutex);
+        Stage& stage = Find(name);
+        ++stage.calls;
+        stage.wallMs += wallMs;
+        stage.cpuMs += cpuMs;
+        stage.peakRssMb = std::max(stage.peakRssMb, peakRss);
+    }
+    
+    void RecordAsrCall(double ms) {
+        std::lock_guard<std::mutex> lock(mutex);
+        asrCallMs.push_back(ms);
+    }
+    
+    void RecordCascade(bool redecoded) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++cascadeSegments;
+        cascadeRedecoded += redecoded ? 1 : 0;
+    }
+    
+    // Fraction of cascade spans that were re-decoded by the main model
+    double CascadeRedecodedFraction() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return cascadeSegments > 0 ? static_cast<double>(cascadeRedecoded) / cascadeSegments : 0.0;
+    }
+    
+    double AudioSeconds() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return audioSeconds;
+    }
+    
+    size_t AsrCallCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return asrCallMs.size();
+    }
+    
+    double AsrCallPercentile(double fraction) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return Percentile(asrCallMs, fraction);
+    }
+    
+    void Merge(const StageStats& other) {
+        std::vector<Stage> otherStages;
+        std::vector<double> otherCalls;
+        double otherAudio;
+        int otherCascadeSegments, otherCascadeRedecoded;
+        {
+            std::lock_guard<std::mutex> lock(other.mutex);
+            otherStages = other.stages;
+            otherCalls = other.asrCallMs;
+            otherAudio = other.audioSeconds;
+            otherCascadeSegments = other.cascadeSegments;
+            otherCascadeRedecoded = other.cascadeRedecoded;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& otherStage : otherStages) {
+            Stage& stage = Find(otherStage.name);
+            stage.calls += otherStage.calls;
+            stage.wallMs += otherStage.wallMs;
+            stage.cpuMs += otherStage.cpuMs;
+            stage.peakRssMb = std::max(stage.peakRssMb, otherStage.peakRssMb);
+        }
+        asrCallMs.insert(asrCallMs.end(), otherCalls.begin(), otherCalls.end());
+        audioSeconds += otherAudio;
+        cascadeSegments += otherCascadeSegments;
+        cascadeRedecoded += otherCascadeRedecoded;
+    }
+    
+    void PrintTable() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::cout << "Stage timings: " << label << " (" << std::fixed << std::setprecision(1) << audioSeconds << " s of audio)" << std::endl;
+        std::cout << "  " << std::left << std::setw(20) << "Stage" << std::right << std::setw(7) << "Calls"
+                  << std::setw(12) << "Wall ms" << std::setw(12) << "CPU ms" << std::setw(9) << "RTF"
+                  << std::setw(13) << "Peak RSS MB" << std::endl;
+        for (const auto& stage : stages) {
+            double rtf = audioSeconds > 0.0 ? stage.wallMs / 1000.0 / audioSeconds : 0.0;
+            std::cout << "  " << std::left << std::setw(20) << stage.name << std::right << std::setw(7) << stage.calls
+                      << std::setw(12) << std::setprecision(1) << stage.wallMs << std::setw(12) << stage.cpuMs
+                      << std::setw(9) << std::setprecision(4) << rtf << std::setw(13) << std::setprecision(1)
+                      << stage.peakRssMb << std::endl;
+        }
+        
+        if (!asrCallMs.empty()) {
+            std::vector<double> bounds = HistogramBounds();
+            std::vector<int> counts(bounds.size() + 1, 0);
+            for (double ms : asrCallMs) {
+                size_t bucket = std::upper_bound(bounds.begin(), bounds.end(), ms) - bounds.begin();
+                ++counts[bucket];
+            }
+            std::cout << "  ASR calls: " << asrCallMs.size() << ", p50 " << std::setprecision(1) << Percentile(asrCallMs, 0.50)
+                      << " ms, p95 " << Percentile(asrCallMs, 0.95) << " ms, p99 " << Percentile(asrCallMs, 0.99)
+                      << " ms, max " << *std::max_element(asrCallMs.begin(), asrCallMs.end()) << " ms" << std::endl;
+            std::cout << "  ASR latency histogram:";
+            for (size_t b = 0; b < counts.size(); ++b) {
+                std::cout << (b < bounds.size() ? " <" + std::to_string(static_cast<int>(bounds[b])) : " >=" + std::to_string(static_cast<int>(bounds.back())))
+                          << "ms:" << counts[b];
+            }
+            std::cout << std::endl;
+        }
+        if (cascadeSegments > 0) {
+            std::cout << "  Cascade: " << cascadeRedecoded << " of " << cascadeSegments << " spans re-decoded by the main model ("
+                      << std::setprecision(1) << 100.0 * cascadeRedecoded / cascadeSegments << "%)" << std::endl;
+        }
+        std::cout << std::defaultfloat << std::setprecision(6);
+    }
+    
+    void WriteJson(std::ostream& out, const std::string& indent) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        out << std::fixed << std::setprecision(3);
+        out << indent << "{" << std::endl;
+        out << indent << "  \"label\": \"" << JsonEscape(label) << "\"," << std::endl;
+        out << indent << "  \"audio_seconds\": " << audioSeconds << "," << std::endl;
+        out << indent << "  \"stages\": [" << std::endl;
+        for (size_t i = 0; i < stages.size(); ++i) {
+            const Stage& stage = stages[i];
+            double rtf = audioSeconds > 0.0 ? stage.wallMs / 1000.0 / audioSeconds : 0.0;
+            out << indent << "    {\"name\": \"" << stage.name << "\", \"calls\": " << stage.calls
+                << ", \"wall_ms\": " << stage.wallMs << ", \"cpu_ms\": " << stage.cpuMs
+                << ", \"rtf\": " << std::setprecision(6) << rtf << std::setprecision(3)
+                << ", \"peak_rss_mb\": " << stage.peakRssMb << "}" << (i + 1 < stages.size() ? "," : "") << std::endl;
+        }
+        out << indent << "  ]," << std::endl;
+        
+        std::vector<double> bounds = HistogramBounds();
+        std::vector<int> counts(bounds.size() + 1, 0);
+        for (double ms : asrCallMs) {
+            ++counts[std::upper_bound(bounds.begin(), bounds.end(), ms) - bounds.begin()];
+        }
+        out << indent << "  \"asr_calls\": {\"count\": " << asrCallMs.size()
+            << ", \"p50_ms\": " << Percentile(asrCallMs, 0.50) << ", \"p95_ms\": " << Percentile(asrCallMs, 0.95)
+            << ", \"p99_ms\": " << Percentile(asrCallMs, 0.99) << ", \"histogram_upper_ms\": [";
+        for (size_t b = 0; b < bounds.size(); ++b) {
+            out << (b > 0 ? ", " : "") << bounds[b];
+        }
+        out << "], \"histogram_counts\": [";
+        for (size_t b = 0; b < counts.size(); ++b) {
+            out << (b > 0 ? ", " : "") << counts[b];
+        }
+        out << "]}";
+        if (cascadeSegments > 0) {
+            out << "," << std::endl;
+            out << indent << "  \"cascade\": {\"spans\": " << cascadeSegments << ", \"redecoded\": " << cascadeRedecoded << "}";
+        }
+        out << std::endl;
+        out << indent << "}";
+        out << std::defaultfloat << std::setprecision(6);
+    }
+};
+
+// Times a scope as one call of a stage; a null StageStats makes it a no-op
+class StageTimer {
+private:
+    StageStats* stats;
+    std::string name;
+    std::chrono::steady_clock::time_point wallStart;
+    double cpuStart;
+    
+public:
+    StageTimer(StageStats* stageStats, const std::string& stageName)
+        : stats(stageStats), name(stageName), wallStart(std::chrono::steady_clock::now()),
+          cpuStart(stageStats ? ProcessCpuMs() : 0.0) {}
+    
+    ~StageTimer() {
+        if (stats) {
+            double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+            stats->Record(name, wallMs, ProcessCpuMs() - cpuStart);
+        }
+    }
+};
+
+// What a job needs from the engine; models it does not touch are never loaded
+enum class TranscriptionMode {
+    Diarize,    // Speaker diarization + ASR, VAD + ASR as fallback
+    NoDiarize,  // VAD + ASR, one speaker per track
+    VadOnly     // Speech regions only, no ASR
+};
+
+// Bit flags naming the engine's models
+const unsigned kRecognizerModel = 1u << 0;
+const unsigned kVadModel = 1u << 1;
+const unsigned kDiarizationModel = 1u << 2;
+const unsigned kEmbeddingModel = 1u << 3;  // Standalone speaker embedding extractor
+const unsigned kFastRecognizerModel = 1u << 4;  // Small first-pass recognizer of the cascade
+
+inline unsigned ModelsForMode(TranscriptionMode mode) {
+    switch (mode) {
+        case TranscriptionMode::Diarize: return kRecognizerModel | kDiarizationModel;
+        case TranscriptionMode::NoDiarize: return kRecognizerModel | kVadModel;
+        case TranscriptionMode::VadOnly: return kVadModel;
+    }
+    return 0;
+}
+
+class TranscriptionEngine {
+private:
+    const SherpaOnnxOfflineRecognizer* recognizer;
+    const SherpaOnnxOfflineRecognizer* fastRecognizer;
+    const SherpaOnnxVoiceActivityDetector* vad;
+    const SherpaOnnxOfflineSpeakerDiarization* diarization;
+    const SherpaOnnxSpeakerEmbeddingExtractor* embeddingExtractor;
+    // Each model is created at most once, either by Initialize or on first use
+    std::once_flag recognizerOnce;
+    std::once_flag fastRecognizerOnce;
+    std::once_flag vadOnce;
+    std::once_flag diarizationOnce;
+    std::once_flag embeddingExtractorOnce;
+    std::mutex tierMutex;
+    std::map<std::string, const SherpaOnnxOfflineRecognizer*> tierRecognizers;  // Further ASR models, by directory
+    std::mutex vadMutex; // The VAD is stateful, so only one file may stream through it at a time
+    bool initialized;
+    bool optimizedModelCache;
+    std::mutex optimizeMutex;  // Models sharing a file (the embedding model) are optimized once
+    std::string modelPath;
+    std::string fastModelPath;
+    std::string vadModelPath;
+    std::string segmentationModelPath;
+    std::string embeddingModelPath;
+    StartupTimings startupTimings;
+    
+public:
+    // Samples submitted to the VAD per call (10 s); the detector windows them internally
+    static constexpr int64_t kVadFeedSamples = 10 * 16000;
+    
+    TranscriptionEngine(const std::string& modelDir, const std::string& vadModelFile, 
+                       const std::string& segmentationModel, const std::string& embeddingModel,
+                       const std::string& fastModelDir = "") 
+        : recognizer(nullptr), fastRecognizer(nullptr), vad(nullptr), diarization(nullptr), embeddingExtractor(nullptr),
+          initialized(false), optimizedModelCache(true), modelPath(modelDir), fastModelPath(fastModelDir), vadModelPath(vadModelFile), 
+          segmentationModelPath(segmentationModel), embeddingModelPath(embeddingModel) {
+    }
+    
+    ~TranscriptionEngine() {
+        if (recognizer) {
+            SherpaOnnxDestroyOfflineRecognizer(recognizer);
+        }
+        if (fastRecognizer) {
+            SherpaOnnxDestroyOfflineRecognizer(fastRecognizer);
+        }
+        for (const auto& tier : tierRecognizers) {
+            if (tier.second) {
+                SherpaOnnxDestroyOfflineRecognizer(tier.second);
+            }
+        }
+        if (vad) {
+            SherpaOnnxDestroyVoiceActivityDetector(vad);
+        }
+        if (diarization) {
+            SherpaOnnxDestroyOfflineSpeakerDiarization(diarization);
+        }
+        if (embeddingExtractor) {
+            SherpaOnnxDestroySpeakerEmbeddingExtractor(embeddingExtractor);
+        }
+    }
+    
+    // Whether models are loaded from optimized copies, written on first load; set before loading
+    void SetOptimizedModelCache(bool enabled) {
+        optimizedModelCache = enabled;
+    }
+    
+    // Loads the given models up front; everything else is created lazily on first use. With
+    // warmUp, each of them also runs once on synthetic audio so that the first real call does
+    // not pay for ONNX Runtime's kernel selection and buffer allocation.
+    bool Initialize(unsigned preloadModels, bool warmUp = false) {
+        auto initStart = std::chrono::steady_clock::now();
+        
+        if (!CheckModelFiles(preloadModels)) {
+            return false;
+        }
+        
+        startupTimings.fileCheckMs = ElapsedMs(initStart);
+        
+        // Each model parses and optimizes its own ONNX graph, so load them side by side
+        std::vector<std::thread> loaders;
+        if (preloadModels & kRecognizerModel) {
+            loaders.emplace_back([this] { EnsureRecognizer(); });
+        }
+        if (preloadModels & kFastRecognizerModel) {
+            loaders.emplace_back([this] { EnsureFastRecognizer(); });
+        }
+        if (preloadModels & kVadModel) {
+            loaders.emplace_back([this] { EnsureVad(); });
+        }
+        if (preloadModels & kDiarizationModel) {
+            loaders.emplace_back([this] { EnsureDiarization(); });
+        }
+        if (preloadModels & kEmbeddingModel) {
+            loaders.emplace_back([this] { EnsureEmbeddingExtractor(); });
+        }
+        for (auto& loader : loaders) {
+            loader.join();
+        }
+        
+        if (warmUp) {
+            auto warmUpStart = std::chrono::steady_clock::now();
+            WarmUp(preloadModels);
+            startupTimings.warmUpMs = ElapsedMs(warmUpStart);
+        }
+        
+        startupTimings.totalMs = ElapsedMs(initStart);
+        
+        if (((preloadModels & kRecognizerModel) && !recognizer) ||
+            ((preloadModels & kFastRecognizerModel) && !fastRecognizer) ||
+            ((preloadModels & kVadModel) && !vad) ||
+            ((preloadModels & kDiarizationModel) && !diarization) ||
+            ((preloadModels & kEmbeddingModel) && !embeddingExtractor)) {
+            return false;
+        }
+        
+        initialized = true;
+        std::cout << "Transcription engine initialized successfully" << std::endl;
+        std::cout << "ASR Model: " << modelPath << std::endl;
+        if (!fastModelPath.empty()) {
+            std::cout << "Fast ASR Model: " << fastModelPath << std::endl;
+        }
+        std::cout << "VAD Model: " << vadModelPath << std::endl;
+        std::cout << "Segmentation Model: " << segmentationModelPath << std::endl;
+        std::cout << "Embedding Model: " << embeddingModelPath << std::endl;
+        PrintStartupTimings();
+        return true;
+    }
+    
+    const StartupTimings& GetStartupTimings() const {
+        return startupTimings;
+    }
+    
+    void PrintStartupTimings() const {
+        std::cout << "Startup timing:" << std::endl;
+        std::cout << std::fixed << std::setprecision(1);
+        std::cout << "  File checks:        " << std::setw(9) << startupTimings.fileCheckMs << " ms" << std::endl;
+        PrintModelTiming("Recognizer:         ", recognizer != nullptr, startupTimings.recognizerMs);
+        if (!fastModelPath.empty()) {
+            PrintModelTiming("Fast recognizer:    ", fastRecognizer != nullptr, startupTimings.fastRecognizerMs);
+        }
+        PrintModelTiming("VAD:                ", vad != nullptr, startupTimings.vadMs);
+        PrintModelTiming("Diarization:        ", diarization != nullptr, startupTimings.diarizationMs);
+        PrintModelTiming("Speaker embedding:  ", embeddingExtractor != nullptr, startupTimings.embeddingExtractorMs);
+        if (startupTimings.warmUpMs > 0.0) {
+            std::cout << "  Warm-up:            " << std::setw(9) << startupTimings.warmUpMs << " ms" << std::endl;
+        }
+        std::cout << "  Total (parallel):   " << std::setw(9) << startupTimings.totalMs << " ms" << std::endl;
+        if (optimizedModelCache) {
+            std::cout << "  Optimized models:   " << startupTimings.optimizedModelsReused << " reused, "
+                      << startupTimings.optimizedModelsWritten << " written" << std::endl;
+        }
+        std::cout << std::defaultfloat << std::setprecision(6);
+    }
+    
+    // Writes the startup breakdown, including first-inference latencies once they are known
+    bool WriteStartupJson(const std::string& filename) const {
+        std::ofstream file(filename);
+        if (!file.is_open()) {
+            std::cerr << "Error: Failed to create startup timing file: " << filename << std::endl;
+            return false;
+        }
+        
+        file << std::fixed << std::setprecision(3);
+        file << "{" << std::endl;
+        file << "  \"file_check_ms\": " << startupTimings.fileCheckMs << "," << std::endl;
+        file << "  \"recognizer_ms\": " << startupTimings.recognizerMs << "," << std::endl;
+        file << "  \"fast_recognizer_ms\": " << startupTimings.fastRecognizerMs << "," << std::endl;
+        file << "  \"vad_ms\": " << startupTimings.vadMs << "," << std::endl;
+        file << "  \"diarization_ms\": " << startupTimings.diarizationMs << "," << std::endl;
+        file << "  \"embedding_extractor_ms\": " << startupTimings.embeddingExtractorMs << "," << std::endl;
+        file << "  \"warm_up_ms\": " << startupTimings.warmUpMs << "," << std::endl;
+        file << "  \"total_ms\": " << startupTimings.totalMs << "," << std::endl;
+        file << "  \"optimized_models_reused\": " << startupTimings.optimizedModelsReused << "," << std::endl;
+        file << "  \"optimized_models_written\": " << startupTimings.optimizedModelsWritten << "," << std::endl;
+        file << "  \"first_asr_inference_ms\": " << startupTimings.firstAsrInferenceMs.load() << "," << std::endl;
+        file << "  \"first_diarization_inference_ms\": " << startupTimings.firstDiarizationInferenceMs.load() << std::endl;
+        file << "}" << std::endl;
+        return true;
+    }
+    
+private:
+    static void PrintModelTiming(const char* label, bool loaded, double ms) {
+        if (loaded) {
+            std::cout << "  " << label << std::setw(9) << ms << " ms" << std::endl;
+        } else {
+            std::cout << "  " << label << "   (lazy)" << std::endl;
+        }
+    }
+    
+    // A Moonshine graph of a model directory: the int8 variant if there is one, else fp32
+    static std::string MoonshineGraph(const std::string& directory, const std::string& name) {
+        std::string int8 = directory + "/" + name + ".int8.onnx";
+        return std::filesystem::exists(int8) ? int8 : directory + "/" + name + ".onnx";
+    }
+    
+    static bool HasMoonshineFiles(const std::string& directory) {
+        return std::filesystem::exists(directory + "/preprocess.onnx") && 
+               std::filesystem::exists(MoonshineGraph(directory, "encode")) && 
+               std::filesystem::exists(MoonshineGraph(directory, "uncached_decode")) && 
+               std::filesystem::exists(MoonshineGraph(directory, "cached_decode")) && 
+               std::filesystem::exists(directory + "/tokens.txt");
+    }
+    
+    bool CheckModelFiles(unsigned models) const {
+        if ((models & kRecognizerModel) && !HasMoonshineFiles(modelPath)) {
+            std::cerr << "Error: Required model files not found in " << modelPath << std::endl;
+            return false;
+        }
+        
+        if ((models & kFastRecognizerModel) && (fastModelPath.empty() || !HasMoonshineFiles(fastModelPath))) {
+            std::cerr << "Error: Required fast model files not found in " << (fastModelPath.empty() ? "(none configured)" : fastModelPath) << std::endl;
+            return false;
+        }
+        
+        if ((models & kVadModel) && !std::filesystem::exists(vadModelPath)) {
+            std::cerr << "Error: VAD model file not found: " << vadModelPath << std::endl;
+            return false;
+        }
+        
+        if ((models & kDiarizationModel) && !std::filesystem::exists(segmentationModelPath)) {
+            std::cerr << "Error: Segmentation model file not found: " << segmentationModelPath << std::endl;
+            return false;
+        }
+        
+        if ((models & (kDiarizationModel | kEmbeddingModel)) && !std::filesystem::exists(embeddingModelPath)) {
+            std::cerr << "Error: Embedding model file not found: " << embeddingModelPath << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    // Thread-safe lazy accessors; a failed creation is not retried
+    bool EnsureRecognizer() {
+        std::call_once(recognizerOnce, [this] {
+            if (CheckModelFiles(kRecognizerModel)) {
+                CreateRecognizer();
+            }
+        });
+        return recognizer != nullptr;
+    }
+    
+    bool EnsureFastRecognizer() {
+        std::call_once(fastRecognizerOnce, [this] {
+            if (CheckModelFiles(kFastRecognizerModel)) {
+                auto start = std::chrono::steady_clock::now();
+                fastRecognizer = CreateMoonshineRecognizer(fastModelPath);
+                startupTimings.fastRecognizerMs = ElapsedMs(start);
+                if (fastRecognizer == nullptr) {
+                    std::cerr << "Error: Failed to create the fast recognizer from " << fastModelPath << std::endl;
+                }
+            }
+        });
+        return fastRecognizer != nullptr;
+    }
+    
+    // Recognizer of an ASR model directory: the main or the fast model, or any other model
+    // tier, which is loaded on first use and kept. Null if the model cannot be loaded.
+    const SherpaOnnxOfflineRecognizer* RecognizerFor(const std::string& directory) {
+        if (directory.empty() || directory == modelPath) {
+            return EnsureRecognizer() ? recognizer : nullptr;
+        }
+        if (directory == fastModelPath) {
+            return EnsureFastRecognizer() ? fastRecognizer : nullptr;
+        }
+        
+        std::lock_guard<std::mutex> lock(tierMutex);
+        auto it = tierRecognizers.find(directory);
+        if (it == tierRecognizers.end()) {
+            // A failed model is remembered as null and not retried
+            const SherpaOnnxOfflineRecognizer* created = nullptr;
+            if (!HasMoonshineFiles(directory)) {
+                std::cerr << "Error: Required model files not found in " << directory << std::endl;
+            } else {
+                auto start = std::chrono::steady_clock::now();
+                created = CreateMoonshineRecognizer(directory);
+                std::cout << "Loaded ASR model " << directory << " in " << std::fixed << std::setprecision(1) << ElapsedMs(start)
+                          << " ms" << std::defaultfloat << std::setprecision(6) << std::endl;
+            }
+            it = tierRecognizers.emplace(directory, created).first;
+        }
+        return it->second;
+    }
+    
+    bool EnsureVad() {
+        std::call_once(vadOnce, [this] {
+            if (CheckModelFiles(kVadModel)) {
+                CreateVad();
+            }
+        });
+        return vad != nullptr;
+    }
+    
+    bool EnsureDiarization() {
+        std::call_once(diarizationOnce, [this] {
+            if (CheckModelFiles(kDiarizationModel)) {
+                CreateDiarization();
+            }
+        });
+        return diarization != nullptr;
+    }
+    
+    bool EnsureEmbeddingExtractor() {
+        std::call_once(embeddingExtractorOnce, [this] {
+            if (CheckModelFiles(kEmbeddingModel)) {
+                CreateEmbeddingExtractor();
+            }
+        });
+        return embeddingExtractor != nullptr;
+    }
+    
+    static double ElapsedMs(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    
+    // Records the latency of the first call of a kind; negative means not measured yet
+    static void RecordFirstInference(std::atomic<double>& slot, double elapsedMs, const char* label) {
+        double unset = -1.0;
+        if (slot.compare_exchange_strong(unset, elapsedMs)) {
+            std::cout << "First " << label << " inference: " << std::fixed << std::setprecision(1) 
+                      << elapsedMs << " ms" << std::defaultfloat << std::setprecision(6) << std::endl;
+        }
+    }
+    
+    bool CreateRecognizer() {
+        auto start = std::chrono::steady_clock::now();
+        recognizer = CreateMoonshineRecognizer(modelPath);
+        startupTimings.recognizerMs = ElapsedMs(start);
+        
+        if (recognizer == nullptr) {
+            std::cerr << "Error: Failed to create recognizer. Please check your model configuration." << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    const SherpaOnnxOfflineRecognizer* CreateMoonshineRecognizer(const std::string& directory) {
+        std::string preprocessor = ModelFile(directory + "/preprocess.onnx");
+        std::string encoder = ModelFile(MoonshineGraph(directory, "encode"));
+        std::string uncached_decoder = ModelFile(MoonshineGraph(directory, "uncached_decode"));
+        std::string cached_decoder = ModelFile(MoonshineGraph(directory, "cached_decode"));
+        std::string tokens = directory + "/tokens.txt";
+        
+        // Configure offline model
+        SherpaOnnxOfflineModelConfig offline_model_config;
+        memset(&offline_model_config, 0, sizeof(offline_model_config));
+        offline_model_config.debug = 0;  // Set to 1 for debug output
+        offline_model_config.num_threads = 1;
+        offline_model_config.provider = "cpu";
+        offline_model_config.tokens = tokens.c_str();
+        offline_model_config.moonshine.preprocessor = preprocessor.c_str();
+        offline_model_config.moonshine.encoder = encoder.c_str();
+        offline_model_config.moonshine.uncached_decoder = uncached_decoder.c_str();
+        offline_model_config.moonshine.cached_decoder = cached_decoder.c_str();
+        
+        // Configure recognizer
+        SherpaOnnxOfflineRecognizerConfig recognizer_config;
+        memset(&recognizer_config, 0, sizeof(recognizer_config));
+        recognizer_config.decoding_method = "greedy_search";
+        recognizer_config.model_config = offline_model_config;
+        
+        return SherpaOnnxCreateOfflineRecognizer(&recognizer_config);
+    }
+    
+    bool CreateVad() {
+        auto start = std::chrono::steady_clock::now();
+        
+        // Configure VAD
+        std::string vadModel = ModelFile(vadModelPath);
+        SherpaOnnxVadModelConfig vadConfig;
+        memset(&vadConfig, 0, sizeof(vadConfig));
+        vadConfig.silero_vad.model = vadModel.c_str();
+        vadConfig.silero_vad.threshold = 0.25f;
+        vadConfig.silero_vad.min_silence_duration = 0.5f;
+        vadConfig.silero_vad.min_speech_duration = 0.5f;
+        vadConfig.silero_vad.max_speech_duration = 10.0f;
+        vadConfig.silero_vad.window_size = 512;
+        vadConfig.sample_rate = 16000;
+        vadConfig.num_threads = 1;
+        vadConfig.debug = 0;
+        
+        vad = SherpaOnnxCreateVoiceActivityDetector(&vadConfig, 30);
+        startupTimings.vadMs = ElapsedMs(start);
+        
+        if (vad == nullptr) {
+            std::cerr << "Error: Failed to create VAD" << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    bool CreateDiarization() {
+        auto start = std::chrono::steady_clock::now();
+        
+        // Configure speaker diarization
+        std::string segmentationModel = ModelFile(segmentationModelPath);
+        std::string embeddingModel = ModelFile(embeddingModelPath);
+        SherpaOnnxOfflineSpeakerDiarizationConfig diarizationConfig;
+        memset(&diarizationConfig, 0, sizeof(diarizationConfig));
+        diarizationConfig.segmentation.pyannote.model = segmentationModel.c_str();
+        diarizationConfig.embedding.model = embeddingModel.c_str();
+        diarizationConfig.clustering.threshold = 0.5f; // Use threshold instead of fixed number of speakers
+        
+        diarization = SherpaOnnxCreateOfflineSpeakerDiarization(&diarizationConfig);
+        startupTimings.diarizationMs = ElapsedMs(start);
+        
+        if (diarization == nullptr) {
+            std::cerr << "Error: Failed to create speaker diarization" << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    bool CreateEmbeddingExtractor() {
+        auto start = std::chrono::steady_clock::now();
+        
+        std::string embeddingModel = ModelFile(embeddingModelPath);
+        SherpaOnnxSpeakerEmbeddingExtractorConfig extractorConfig;
+        memset(&extractorConfig, 0, sizeof(extractorConfig));
+        extractorConfig.model = embeddingModel.c_str();
+        extractorConfig.num_threads = 1;
+        extractorConfig.provider = "cpu";
+        
+        embeddingExtractor = SherpaOnnxCreateSpeakerEmbeddingExtractor(&extractorConfig);
+        startupTimings.embeddingExtractorMs = ElapsedMs(start);
+        
+        if (embeddingExtractor == nullptr) {
+            std::cerr << "Error: Failed to create speaker embedding extractor" << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    // The file to load a model from: its optimized copy, which is written on first use. Most of
+    // the time ONNX Runtime spends creating a session goes into graph optimizations (constant
+    // folding, operator fusion) that come out the same every time, so a saved optimized graph
+    // loads close to as fast as a warm start. Falls back to the original on any failure, e.g.
+    // when the model directory is read-only.
+    std::string ModelFile(const std::string& path) {
+        if (!optimizedModelCache) {
+            return path;
+        }
+        
+        std::filesystem::path original(path);
+        std::filesystem::path optimized = original;
+        optimized.replace_extension();
+        optimized += OptimizedModelSuffix();
+        std::error_code ec;
+        auto originalTime = std::filesystem::last_write_time(original, ec);
+        if (ec) {
+            return path;
+        }
+        auto isCurrent = [&]() {
+            auto optimizedTime = std::filesystem::last_write_time(optimized, ec);
+            return !ec && optimizedTime >= originalTime;
+        };
+        if (isCurrent()) {
+            ++startupTimings.optimizedModelsReused;
+            return optimized.string();
+        }
+        
+        std::lock_guard<std::mutex> lock(optimizeMutex);
+        if (isCurrent()) {
+            ++startupTimings.optimizedModelsReused;
+            return optimized.string();
+        }
+        
+        // Written under a name of its own and renamed, so that a concurrent process (e.g. the CLI
+        // next to the daemon) neither loads half a file nor writes into this one. optimizeMutex
+        // serializes the writes within this process.
+        std::ostringstream suffix;
+        suffix << ".tmp" << CurrentProcessId();
+        std::filesystem::path temporary = optimized;
+        temporary += suffix.str();
+        
+        const OrtApi* ort = OrtGetApiBase()->GetApi(ORT_API_VERSION);
+        OrtEnv* env = nullptr;
+        OrtSessionOptions* sessionOptions = nullptr;
+        OrtSession* session = nullptr;
+        OrtStatus* status = ort->CreateEnv(ORT_LOGGING_LEVEL_ERROR, "transcribe", &env);
+        if (!status) {
+            status = ort->CreateSessionOptions(&sessionOptions);
+        }
+        // Extended rather than all optimizations: layout changes are left to load time
+        if (!status) {
+            status = ort->SetSessionGraphOptimizationLevel(sessionOptions, ORT_ENABLE_EXTENDED);
+        }
+        if (!status) {
+            status = ort->SetOptimizedModelFilePath(sessionOptions, temporary.c_str());
+        }
+        if (!status) {
+            status = ort->CreateSession(env, original.c_str(), sessionOptions, &session);
+        }
+        
+        bool written = status == nullptr;
+        if (status) {
+            std::cerr << "Warning: Failed to optimize " << path << ", loading it as is: " << ort->GetErrorMessage(status) << std::endl;
+            ort->ReleaseStatus(status);
+        }
+        if (session) {
+            ort->ReleaseSession(session);
+        }
+        if (sessionOptions) {
+            ort->ReleaseSessionOptions(sessionOptions);
+        }
+        if (env) {
+            ort->ReleaseEnv(env);
+        }
+        
+        if (written) {
+            std::filesystem::rename(temporary, optimized, ec);
+            written = !ec;
+        }
+        if (!written) {
+            std::filesystem::remove(temporary, ec);
+            // Another process may have renamed its copy into place first (Windows refuses to
+            // replace a file that is open), in which case that copy is as good as this one
+            if (isCurrent()) {
+                ++startupTimings.optimizedModelsReused;
+                return optimized.string();
+            }
+            return path;
+        }
+        ++startupTimings.optimizedModelsWritten;
+        return optimized.string();
+    }
+    
+    // Runs each of the given models once, side by side, on a couple of seconds of synthetic
+    // audio. Goes straight to sherpa-onnx so none of it counts as the first inference.
+    void WarmUp(unsigned models) {
+        std::vector<float> audio(2 * 16000);
+        uint32_t state = 12345;
+        for (size_t i = 0; i < audio.size(); ++i) {
+            state = state * 1664525u + 1013904223u;
+            float noise = (static_cast<float>(state >> 8) / 16777216.0f - 0.5f) * 0.01f;
+            audio[i] = 0.1f * std::sin(2.0f * 3.14159265f * 220.0f * i / 16000.0f) + noise;
+        }
+        int32_t n = static_cast<int32_t>(audio.size());
+        
+        std::vector<std::thread> runners;
+        auto recognize = [&audio, n](const SherpaOnnxOfflineRecognizer* model) {
+            const SherpaOnnxOfflineStream* stream = SherpaOnnxCreateOfflineStream(model);
+            SherpaOnnxAcceptWaveformOffline(stream, 16000, audio.data(), n);
+            SherpaOnnxDecodeOfflineStream(model, stream);
+            const SherpaOnnxOfflineRecognizerResult* result = SherpaOnnxGetOfflineStreamResult(stream);
+            if (result) {
+                SherpaOnnxDestroyOfflineRecognizerResult(result);
+            }
+            SherpaOnnxDestroyOfflineStream(stream);
+        };
+        if ((models & kRecognizerModel) && recognizer) {
+            runners.emplace_back(recognize, recognizer);
+        }
+        if ((models & kFastRecognizerModel) && fastRecognizer) {
+            runners.emplace_back(recognize, fastRecognizer);
+        }
+        if ((models & kVadModel) && vad) {
+            runners.emplace_back([this, &audio, n] {
+                std::lock_guard<std::mutex> lock(vadMutex);
+                SherpaOnnxVoiceActivityDetectorReset(vad);
+                SherpaOnnxVoiceActivityDetectorAcceptWaveform(vad, audio.data(), n);
+                SherpaOnnxVoiceActivityDetectorFlush(vad);
+                while (!SherpaOnnxVoiceActivityDetectorEmpty(vad)) {
+                    SherpaOnnxDestroySpeechSegment(SherpaOnnxVoiceActivityDetectorFront(vad));
+                    SherpaOnnxVoiceActivityDetectorPop(vad);
+                }
+                SherpaOnnxVoiceActivityDetectorReset(vad);
+            });
+        }
+        if ((models & kDiarizationModel) && diarization) {
+            runners.emplace_back([this, &audio, n] {
+                const SherpaOnnxOfflineSpeakerDiarizationResult* result =
+                    SherpaOnnxOfflineSpeakerDiarizationProcess(diarization, audio.data(), n);
+                if (result) {
+                    SherpaOnnxOfflineSpeakerDiarizationDestroyResult(result);
+                }
+            });
+        }
+        if ((models & kEmbeddingModel) && embeddingExtractor) {
+            runners.emplace_back([this, &audio, n] {
+                std::vector<float> embedding;
+                ComputeEmbedding(audio.data(), n, embedding);
+            });
+        }
+        for (auto& runner : runners) {
+            runner.join();
+        }
+    }
+    
+    static void PrintAudioInfo(const WavReader& wav, const ResampledSource& audio) {
+        std::cout << "Audio info - Sample rate: " << wav.SampleRate() << " Hz";
+        if (audio.IsResampling()) {
+            std::cout << " (resampled to " << audio.SampleRate() << " Hz)";
+        }
+        std::cout << ", Channels: " << wav.Channels() << ", Samples: " << audio.NumSamples() << std::endl;
+    }
+    
+    // Runs the VAD over the whole audio, submitting feedSamples per call (the detector cuts its
+    // own 512-sample windows), and hands every speech segment to onSpeech before destroying
+    // it. All samples, including a final partial window, are submitted before the flush;
+    // dropLastWindow instead stops before the last window like the old per-window loop, and
+    // is only used to compare against it. The caller holds vadMutex. wallMs and cpuMs are
+    // increased by the time spent in the detector itself (on the calling thread), excluding onSpeech.
+    void RunVad(const AudioSource& audio, int64_t feedSamples, bool dropLastWindow,
+                const std::function<void(const SherpaOnnxSpeechSegment*)>& onSpeech, double& wallMs, double& cpuMs) {
+        const int64_t kWindowSamples = 512;  // Silero VAD window size
+        int64_t numSamples = audio.NumSamples();
+        if (dropLastWindow) {
+            numSamples = std::max<int64_t>(0, (numSamples - 1) / kWindowSamples * kWindowSamples);
+        }
+        
+        auto drain = [&]() {
+            while (!SherpaOnnxVoiceActivityDetectorEmpty(vad)) {
+                const SherpaOnnxSpeechSegment* segment = SherpaOnnxVoiceActivityDetectorFront(vad);
+                onSpeech(segment);
+                SherpaOnnxDestroySpeechSegment(segment);
+                SherpaOnnxVoiceActivityDetectorPop(vad);
+            }
+        };
+        
+        SherpaOnnxVoiceActivityDetectorReset(vad);
+        std::vector<float> block;
+        for (int64_t blockStart = 0; blockStart < numSamples; blockStart += feedSamples) {
+            const float* samples = audio.Span(blockStart, std::min(numSamples, blockStart + feedSamples), block);
+            auto vadStart = std::chrono::steady_clock::now();
+            double vadCpuStart = ThreadCpuMs();
+            SherpaOnnxVoiceActivityDetectorAcceptWaveform(vad, samples, static_cast<int32_t>(block.size()));
+            wallMs += ElapsedMs(vadStart);
+            cpuMs += ThreadCpuMs() - vadCpuStart;
+            drain();
+        }
+        
+        auto vadStart = std::chrono::steady_clock::now();
+        double vadCpuStart = ThreadCpuMs();
+        SherpaOnnxVoiceActivityDetectorFlush(vad);
+        wallMs += ElapsedMs(vadStart);
+        cpuMs += ThreadCpuMs() - vadCpuStart;
+        drain();
+    }
+    
+    // Computes a speaker embedding for a span of 16 kHz audio; false if the span is too short
+    bool ComputeEmbedding(const float* samples, int32_t n, std::vector<float>& embedding) {
+        const SherpaOnnxOnlineStream* stream = SherpaOnnxSpeakerEmbeddingExtractorCreateStream(embeddingExtractor);
+        SherpaOnnxOnlineStreamAcceptWaveform(stream, 16000, samples, n);
+        SherpaOnnxOnlineStreamInputFinished(stream);
+        
+        bool ready = SherpaOnnxSpeakerEmbeddingExtractorIsReady(embeddingExtractor, stream) != 0;
+        if (ready) {
+            const float* values = SherpaOnnxSpeakerEmbeddingExtractorComputeEmbedding(embeddingExtractor, stream);
+            int32_t dim = SherpaOnnxSpeakerEmbeddingExtractorDim(embeddingExtractor);
+            embedding.assign(values, values + dim);
+            SherpaOnnxSpeakerEmbeddingExtractorDestroyEmbedding(values);
+        }
+        
+        SherpaOnnxDestroyOnlineStream(stream);
+        return ready;
+    }
+    
+    // Decodes the regions on a pool of workers, splitting any region longer than
+    // settings.maxSegmentSeconds at quiet points and joining the pieces' text again.
+    // onRegionDone is called once per region, in region order, from whichever worker
+    // completes the region that unblocks it.
+    void DecodeRegions(const AudioSource& audio, const std::vector<DecodeRegion>& regions, const DecodeSettings& settings,
+                       const std::function<void(size_t, const std::string&)>& onRegionDone, StageStats* stats) {
+        StageTimer timer(stats, "asr");
+        struct Piece {
+            size_t region;
+            int64_t startSample;
+            int64_t endSample;
+        };
+        
+        int64_t maxSamples = static_cast<int64_t>(settings.maxSegmentSeconds * 16000);
+        std::vector<Piece> pieces;
+        std::vector<size_t> piecesLeft(regions.size(), 0);
+        std::vector<size_t> firstPiece(regions.size(), 0);
+        for (size_t r = 0; r < regions.size(); ++r) {
+            firstPiece[r] = pieces.size();
+            for (const auto& span : SplitAtQuietPoints(audio, regions[r].startSample, regions[r].endSample, maxSamples)) {
+                pieces.push_back({r, span.first, span.second});
+                ++piecesLeft[r];
+            }
+        }
+        
+        if (pieces.size() > regions.size()) {
+            std::cout << "Split long turns: " << regions.size() << " regions -> " << pieces.size() << " decode calls" << std::endl;
+        }
+        
+        std::vector<std::string> pieceTexts(pieces.size());
+        std::vector<std::string> regionTexts(regions.size());
+        std::mutex completionMutex;
+        size_t nextRegionToReport = 0;
+        
+        ParallelFor(pieces.size(), settings.workers, [&](size_t p) {
+            // Each worker converts its pieces into its own buffer, reused from piece to piece
+            thread_local std::vector<float> buffer;
+            const Piece& piece = pieces[p];
+            const float* samples = audio.Span(piece.startSample, piece.endSample, buffer);
+            pieceTexts[p] = Decode(samples, static_cast<int32_t>(buffer.size()), settings, stats);
+            
+            std::lock_guard<std::mutex> lock(completionMutex);
+            --piecesLeft[piece.region];
+            
+            // Report every finished region that is next in line
+            while (nextRegionToReport < regions.size() && piecesLeft[nextRegionToReport] == 0) {
+                std::string& text = regionTexts[nextRegionToReport];
+                for (size_t q = firstPiece[nextRegionToReport]; q < pieces.size() && pieces[q].region == nextRegionToReport; ++q) {
+                    text = JoinText(text, pieceTexts[q]);
+                }
+                onRegionDone(nextRegionToReport, text);
+                ++nextRegionToReport;
+            }
+        });
+    }
+    
+    // Progress of one diarization call. The pipeline segments the whole span first and then
+    // reports progress once per embedding batch, so the first report marks the end of
+    // segmentation and the last one the end of embedding extraction; clustering follows.
+    struct DiarizationProgress {
+        std::chrono::steady_clock::time_point wall[2];  // First and last report
+        double cpuMs[2];
+        int reports = 0;
+        
+        static int32_t OnProgress(int32_t /*processed*/, int32_t /*total*/, void* arg) {
+            DiarizationProgress* progress = static_cast<DiarizationProgress*>(arg);
+            int slot = progress->reports == 0 ? 0 : 1;
+            progress->wall[slot] = std::chrono::steady_clock::now();
+            progress->cpuMs[slot] = ProcessCpuMs();
+            if (progress->reports++ == 0) {
+                progress->wall[1] = progress->wall[0];
+                progress->cpuMs[1] = progress->cpuMs[0];
+            }
+            return 0;
+        }
+    };
+    
+    // Runs the diarization pipeline on audio[start, end) and returns its turns in absolute
+    // sample positions, with the pipeline's (span-local) speaker labels. The span is
+    // converted into buffer, which the caller reuses from chunk to chunk.
+    bool DiarizeSpan(const AudioSource& audio, int64_t start, int64_t end, std::vector<float>& buffer,
+                     std::vector<SpeakerTurn>& turns, StageStats* stats) {
+        const float* samples = nullptr;
+        {
+            StageTimer timer(stats, "wav_read");
+            samples = audio.Span(start, end, buffer);
+        }
+        
+        auto diarizationStart = std::chrono::steady_clock::now();
+        double cpuStart = ProcessCpuMs();
+        DiarizationProgress progress;
+        const SherpaOnnxOfflineSpeakerDiarizationResult* diarizationResult = 
+            SherpaOnnxOfflineSpeakerDiarizationProcessWithCallback(diarization, samples, static_cast<int32_t>(buffer.size()),
+                                                                   &DiarizationProgress::OnProgress, &progress);
+        RecordFirstInference(startupTimings.firstDiarizationInferenceMs, ElapsedMs(diarizationStart), "diarization");
+        
+        if (stats) {
+            auto wallMs = [](std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+                return std::chrono::duration<double, std::milli>(to - from).count();
+            };
+            auto diarizationEnd = std::chrono::steady_clock::now();
+            double cpuEnd = ProcessCpuMs();
+            if (progress.reports > 0) {
+                stats->Record("segmentation", wallMs(diarizationStart, progress.wall[0]), progress.cpuMs[0] - cpuStart);
+                stats->Record("embedding", wallMs(progress.wall[0], progress.wall[1]), progress.cpuMs[1] - progress.cpuMs[0]);
+                stats->Record("clustering", wallMs(progress.wall[1], diarizationEnd), cpuEnd - progress.cpuMs[1]);
+            } else {
+                stats->Record("diarization", wallMs(diarizationStart, diarizationEnd), cpuEnd - cpuStart);
+            }
+        }
+        
+        if (diarizationResult == nullptr) {
+            std::cerr << "Error: Failed to perform speaker diarization" << std::endl;
+            return false;
+        }
+        
+        int32_t num_segments = SherpaOnnxOfflineSpeakerDiarizationResultGetNumSegments(diarizationResult);
+        const SherpaOnnxOfflineSpeakerDiarizationSegment* segments = 
+            SherpaOnnxOfflineSpeakerDiarizationResultSortByStartTime(diarizationResult);
+        
+        std::cout << "Found " << num_segments << " speaker segments" << std::endl;
+        
+        for (int32_t i = 0; i < num_segments; ++i) {
+            SpeakerTurn turn;
+            turn.startSample = std::max<int64_t>(start, start + static_cast<int64_t>(segments[i].start * 16000));
+            turn.endSample = std::min<int64_t>(end, start + static_cast<int64_t>(segments[i].end * 16000));
+            turn.speaker = segments[i].speaker;
+            turns.push_back(turn);
+        }
+        
+        SherpaOnnxOfflineSpeakerDiarizationDestroySegment(segments);
+        SherpaOnnxOfflineSpeakerDiarizationDestroyResult(diarizationResult);
+        return true;
+    }
+    
+    // Average embedding per speaker, computed from up to three of the speaker's longest turns
+    // (each capped at 10 s). Speakers whose turns are all too short to embed are left out.
+    std::map<int, std::vector<float>> SpeakerCentroids(const AudioSource& audio, const std::vector<SpeakerTurn>& turns, StageStats* stats) {
+        StageTimer timer(stats, "speaker_embedding");
+        const size_t kTurnsPerSpeaker = 3;
+        const int64_t kMaxEmbeddingSamples = 10 * 16000;
+        
+        std::map<int, std::vector<SpeakerTurn>> bySpeaker;
+        for (const auto& turn : turns) {
+            bySpeaker[turn.speaker].push_back(turn);
+        }
+        
+        std::map<int, std::vector<float>> centroids;
+        std::vector<float> buffer;
+        for (auto& pair : bySpeaker) {
+            auto& speakerTurns = pair.second;
+            std::sort(speakerTurns.begin(), speakerTurns.end(), [](const SpeakerTurn& a, const SpeakerTurn& b) {
+                return a.endSample - a.startSample > b.endSample - b.startSample;
+            });
+            
+            std::vector<float> centroid;
+            for (size_t t = 0; t < speakerTurns.size() && t < kTurnsPerSpeaker; ++t) {
+                int64_t length = std::min(speakerTurns[t].endSample - speakerTurns[t].startSample, kMaxEmbeddingSamples);
+                std::vector<float> embedding;
+                const float* samples = audio.Span(speakerTurns[t].startSample, speakerTurns[t].startSample + length, buffer);
+                if (!ComputeEmbedding(samples, static_cast<int32_t>(buffer.size()), embedding)) {
+                    continue;
+                }
+                if (centroid.empty()) {
+                    centroid.assign(embedding.size(), 0.0f);
+                }
+                for (size_t d = 0; d < centroid.size(); ++d) {
+                    centroid[d] += embedding[d];
+                }
+            }
+            
+            if (!centroid.empty()) {
+                centroids[pair.first] = centroid;
+            }
+        }
+        return centroids;
+    }
+    
+    // Plans, coalesces and decodes the turns, reporting segments in time order. Regions that
+    // are already in the journal under this chunk are reported from it instead of being decoded.
+    void TranscribeTurns(const AudioSource& audio, const std::vector<SpeakerTurn>& turns, const DecodeSettings& settings,
+                         const SegmentCallback& onSegment, StageStats* stats, SegmentJournal* journal, int64_t chunk) {
+        // Turns overlap, so plan regions that cover every speech sample exactly once
+        std::vector<DecodeRegion> regions = PlanDecodeRegions(turns);
+        
+        std::cout << "Planned " << regions.size() << " decode regions: " << std::fixed << std::setprecision(2)
+                  << TotalSeconds(regions, 16000) << "s of audio instead of "
+                  << TotalSeconds(turns, 16000) << "s" << std::defaultfloat << std::setprecision(6) << std::endl;
+        
+        size_t plannedRegions = regions.size();
+        regions = CoalesceRegions(regions, static_cast<int64_t>(settings.mergeGapSeconds * 16000),
+                                  static_cast<int64_t>(settings.maxSegmentSeconds * 16000));
+        if (regions.size() < plannedRegions) {
+            std::cout << "Coalesced short same-speaker regions: " << plannedRegions << " -> " << regions.size()
+                      << " (" << (plannedRegions - regions.size()) << " decode calls saved)" << std::endl;
+        }
+        
+        // Regions are journaled in order, so the finished ones are always the first few
+        if (journal) {
+            std::vector<SpeakerSegment> journaled = journal->Regions(chunk);
+            size_t resumed = std::min(journaled.size(), regions.size());
+            for (size_t r = 0; r < resumed; ++r) {
+                if (!journaled[r].text.empty()) {
+                    onSegment(journaled[r]);
+                }
+            }
+            if (resumed > 0) {
+                std::cout << "Resumed " << resumed << " of " << regions.size() << " regions from the journal" << std::endl;
+                regions.erase(regions.begin(), regions.begin() + static_cast<std::ptrdiff_t>(resumed));
+            }
+        }
+        
+        // Transcribe each region; segments are reported in order as soon as they are ready
+        DecodeRegions(audio, regions, settings, [&](size_t index, const std::string& text) {
+            SpeakerSegment segment;
+            segment.start = static_cast<float>(regions[index].startSample) / 16000;
+            segment.end = static_cast<float>(regions[index].endSample) / 16000;
+            segment.speaker = regions[index].speaker;
+            segment.text = text;
+            
+            if (journal) {
+                journal->AddRegion(chunk, segment);
+            }
+            if (text.empty()) {
+                return;
+            }
+            
+            std::cout << "Speaker " << segment.speaker << " [" << segment.start << "s - " << segment.end << "s]: " << text << std::endl;
+            onSegment(segment);
+        }, stats);
+    }
+    
+public:
+    // Transcribes a single span of 16 kHz audio. The call's latency is added to the ASR
+    // histogram of stats, if given.
+    std::string DecodeSamples(const float* samples, int32_t n, StageStats* stats = nullptr) {
+        if (!EnsureRecognizer()) {
+            return "";
+        }
+        return RunRecognizer(recognizer, samples, n, stats, nullptr);
+    }
+    
+    // Decodes a span as settings ask: with the main model (settings.asrModel, if set), or in
+    // cascade mode with the fast model first. The fast model's text is kept when its
+    // confidence (from token log-probabilities if the model reports them, else
+    // HeuristicConfidence, which is what Moonshine models get) reaches settings.cascadeThreshold; otherwise the span is decoded
+    // again by the main model.
+    std::string Decode(const float* samples, int32_t n, const DecodeSettings& settings, StageStats* stats = nullptr) {
+        const SherpaOnnxOfflineRecognizer* model = RecognizerFor(settings.asrModel);
+        if (!model) {
+            return "";
+        }
+        if (!settings.cascade || !EnsureFastRecognizer() || model == fastRecognizer) {
+            return RunRecognizer(model, samples, n, stats, nullptr);
+        }
+        
+        float confidence = 0.0f;
+        std::string text = RunRecognizer(fastRecognizer, samples, n, stats, &confidence);
+        bool redecode = confidence < settings.cascadeThreshold;
+        if (stats) {
+            stats->RecordCascade(redecode);
+        }
+        return redecode ? RunRecognizer(model, samples, n, stats, nullptr) : text;
+    }
+    
+private:
+    // One recognizer call; confidence, if given, receives the confidence in the result
+    std::string RunRecognizer(const SherpaOnnxOfflineRecognizer* model, const float* samples, int32_t n,
+                              StageStats* stats, float* confidence) {
+        auto callStart = std::chrono::steady_clock::now();
+        const SherpaOnnxOfflineStream* stream = SherpaOnnxCreateOfflineStream(model);
+        SherpaOnnxAcceptWaveformOffline(stream, 16000, samples, n);
+        auto decodeStart = std::chrono::steady_clock::now();
+        SherpaOnnxDecodeOfflineStream(model, stream);
+        RecordFirstInference(startupTimings.firstAsrInferenceMs, ElapsedMs(decodeStart), "ASR");
+        if (stats) {
+            stats->RecordAsrCall(ElapsedMs(callStart));
+        }
+        
+        const SherpaOnnxOfflineRecognizerResult* result = SherpaOnnxGetOfflineStreamResult(stream);
+        std::string text = result ? result->text : "";
+        
+        if (confidence) {
+            float meanLogProb = 0.0f;
+            if (result && MeanTokenLogProb(result->json, meanLogProb)) {
+                *confidence = std::exp(meanLogProb);
+            } else {
+                *confidence = HeuristicConfidence(text, n / 16000.0f);
+            }
+        }
+        
+        if (result) {
+            SherpaOnnxDestroyOfflineRecognizerResult(result);
+        }
+        SherpaOnnxDestroyOfflineStream(stream);
+        return text;
+    }
+    
+public:
+
+    // Centroid embedding of every speaker in a transcribed file, keyed by the segments'
+    // speaker IDs. Speakers without enough speech to embed are left out.
+    std::map<int, std::vector<float>> SpeakerEmbeddings(const std::string& wavFile, const std::vector<SpeakerSegment>& segments,
+                                                        StageStats* stats = nullptr) {
+        std::map<int, std::vector<float>> centroids;
+        if (segments.empty() || !EnsureEmbeddingExtractor()) {
+            return centroids;
+        }
+        
+        WavReader wav;
+        if (!wav.Open(wavFile)) {
+            return centroids;
+        }
+        ResampledSource audio(wav, 16000);
+        
+        std::vector<SpeakerTurn> turns;
+        for (const auto& segment : segments) {
+            SpeakerTurn turn;
+            turn.startSample = std::max<int64_t>(0, static_cast<int64_t>(segment.start * 16000));
+            turn.endSample = std::min<int64_t>(audio.NumSamples(), static_cast<int64_t>(segment.end * 16000));
+            turn.speaker = segment.speaker;
+            if (turn.endSample > turn.startSample) {
+                turns.push_back(turn);
+            }
+        }
+        
+        return SpeakerCentroids(audio, turns, stats);
+    }
+    
+    // One embedding per segment (capped at its first 10 s), empty for segments too short to embed
+    std::vector<std::vector<float>> SegmentEmbeddings(const std::string& wavFile, const std::vector<SpeakerSegment>& segments,
+                                                      int workers, StageStats* stats = nullptr) {
+        StageTimer timer(stats, "speaker_embedding");
+        std::vector<std::vector<float>> embeddings(segments.size());
+        if (segments.empty() || !EnsureEmbeddingExtractor()) {
+            return embeddings;
+        }
+        
+        WavReader wav;
+        if (!wav.Open(wavFile)) {
+            return embeddings;
+        }
+        ResampledSource audio(wav, 16000);
+        
+        const int64_t kMaxEmbeddingSamples = 10 * 16000;
+        ParallelFor(segments.size(), workers, [&](size_t i) {
+            thread_local std::vector<float> buffer;
+            int64_t start = std::max<int64_t>(0, static_cast<int64_t>(segments[i].start * 16000));
+            int64_t end = std::min<int64_t>(audio.NumSamples(), static_cast<int64_t>(segments[i].end * 16000));
+            end = std::min(end, start + kMaxEmbeddingSamples);
+            if (end > start) {
+                const float* samples = audio.Span(start, end, buffer);
+                ComputeEmbedding(samples, static_cast<int32_t>(buffer.size()), embeddings[i]);
+            }
+        });
+        
+        return embeddings;
+    }
+    
+    // Cheap check for single-speaker tracks: embeds a few speech windows spread over the
+    // file and measures how far they spread around their centroid (mean cosine distance).
+    // Files with too little speech to tell are treated as single-speaker.
+    bool IsLikelySingleSpeaker(const std::string& wavFile, float maxVariance, StageStats* stats = nullptr) {
+        StageTimer timer(stats, "speaker_embedding");
+        if (!EnsureEmbeddingExtractor()) {
+            return false;
+        }
+        
+        WavReader wav;
+        if (!wav.Open(wavFile)) {
+            return false;
+        }
+        ResampledSource audio(wav, 16000);
+        
+        const int32_t windowSamples = 2 * 16000;
+        const int kMaxWindows = 6;
+        const float kSpeechRms = 0.005f;
+        
+        // Candidate windows that contain enough energy to be speech
+        std::vector<int64_t> speechWindows;
+        std::vector<float> buffer;
+        for (int64_t offset = 0; offset + windowSamples <= audio.NumSamples(); offset += windowSamples) {
+            const float* samples = audio.Span(offset, offset + windowSamples, buffer);
+            double energy = 0.0;
+            for (int32_t k = 0; k < windowSamples; ++k) {
+                float sample = samples[k];
+                energy += sample * sample;
+            }
+            if (std::sqrt(energy / windowSamples) > kSpeechRms) {
+                speechWindows.push_back(offset);
+            }
+        }
+        
+        // Embed up to kMaxWindows of them, evenly spaced in time
+        std::vector<std::vector<float>> embeddings;
+        size_t numWindows = std::min<size_t>(speechWindows.size(), kMaxWindows);
+        for (size_t w = 0; w < numWindows; ++w) {
+            size_t index = numWindows > 1 ? w * (speechWindows.size() - 1) / (numWindows - 1) : 0;
+            std::vector<float> embedding;
+            const float* samples = audio.Span(speechWindows[index], speechWindows[index] + windowSamples, buffer);
+            if (ComputeEmbedding(samples, windowSamples, embedding)) {
+                embeddings.push_back(embedding);
+            }
+        }
+        
+        if (embeddings.size() < 2) {
+            return true;
+        }
+        
+        std::vector<float> centroid(embeddings[0].size(), 0.0f);
+        for (const auto& embedding : embeddings) {
+            for (size_t d = 0; d < centroid.size(); ++d) {
+                centroid[d] += embedding[d];
+            }
+        }
+        
+        float variance = 0.0f;
+        for (const auto& embedding : embeddings) {
+            variance += 1.0f - CosineSimilarity(embedding.data(), centroid.data(), centroid.size());
+        }
+        variance /= embeddings.size();
+        
+        std::cout << "Speaker embedding variance over " << embeddings.size() << " windows: " << variance 
+                  << " (threshold " << maxVariance << ")" << std::endl;
+        return variance <= maxVariance;
+    }
+    
+    std::string TranscribeFile(const std::string& wavFile, StageStats* stats = nullptr) {
+        std::vector<SpeakerSegment> segments;
+        if (!TranscribeWithVad(wavFile, true, segments, nullptr, stats)) {
+            return "";
+        }
+        
+        // Combine all transcriptions
+        std::string fullTranscription;
+        for (size_t j = 0; j < segments.size(); ++j) {
+            if (j > 0) {
+                fullTranscription += " ";
+            }
+            fullTranscription += segments[j].text;
+        }
+        
+        std::cout << "Transcription: " << (fullTranscription.empty() ? "No speech detected" : fullTranscription) << std::endl;
+        
+        return fullTranscription.empty() ? "No speech detected" : fullTranscription;
+    }
+    
+    // Splits the file into speech regions with the VAD and, if decode is set, transcribes each
+    // region. All regions are attributed to speaker 1. Returns false if the file could not be processed.
+    //
+    // Detection and decoding run as a pipeline: this thread feeds the VAD and queues each speech
+    // segment while settings.workers ASR threads decode them. The queue is bounded, so the VAD
+    // waits whenever the decoders fall behind. Segments are still reported in time order.
+    //
+    // With a journal, every region is journaled as it is reported. A resumed run detects the
+    // same regions again (the VAD is cheap next to the ASR) and only decodes the ones after
+    // the journaled prefix; a finished journal replaces the run entirely.
+    bool TranscribeWithVad(const std::string& wavFile, bool decode, std::vector<SpeakerSegment>& segments,
+                           const SegmentCallback& onSegment = nullptr, StageStats* stats = nullptr,
+                           const DecodeSettings& settings = DecodeSettings(), SegmentJournal* journal = nullptr) {
+        if (!EnsureVad() || (decode && !EnsureRecognizer())) {
+            std::cerr << "Error: Transcription engine not initialized" << std::endl;
+            return false;
+        }
+        
+        if (!std::filesystem::exists(wavFile)) {
+            std::cerr << "Error: Audio file not found: " << wavFile << std::endl;
+            return false;
+        }
+        
+        std::cout << (decode ? "Transcribing: " : "Detecting speech: ") << wavFile << std::endl;
+        
+        std::vector<SpeakerSegment> journaled;
+        if (journal) {
+            journal->Start(decode ? "vad" : "vad-only");
+            journaled = journal->Regions(0);
+            if (journal->Complete()) {
+                for (const auto& segment : journaled) {
+                    if (!segment.text.empty()) {
+                        segments.push_back(segment);
+                        if (onSegment) {
+                            onSegment(segment);
+                        }
+                    }
+                }
+                std::cout << "Resumed all " << journaled.size() << " regions from the journal" << std::endl;
+                return true;
+            }
+        }
+        
+        std::lock_guard<std::mutex> vadLock(vadMutex);
+        
+        // Map the WAV file; samples are converted (and resampled) block by block as the VAD reaches them
+        WavReader wav;
+        {
+            StageTimer timer(stats, "wav_read");
+            if (!wav.Open(wavFile)) {
+                return false;
+            }
+        }
+        ResampledSource audio(wav, 16000);
+        PrintAudioInfo(wav, audio);
+        if (stats) {
+            stats->SetAudioSeconds(audio.Seconds());
+        }
+        
+        auto start_time = std::chrono::high_resolution_clock::now();
+        
+        // Segments are decoded out of order; report each one once all earlier ones are done
+        std::mutex reportMutex;
+        std::map<size_t, SpeakerSegment> finished;
+        size_t nextToReport = 0;
+        auto report = [&](size_t index, SpeakerSegment speechSegment) {
+            std::lock_guard<std::mutex> lock(reportMutex);
+            finished[index] = std::move(speechSegment);
+            while (!finished.empty() && finished.begin()->first == nextToReport) {
+                const SpeakerSegment& segment = finished.begin()->second;
+                if (journal && nextToReport >= journaled.size()) {
+                    journal->AddRegion(0, segment);
+                }
+                if (!segment.text.empty()) {
+                    segments.push_back(segment);
+                    if (onSegment) {
+                        onSegment(segment);
+                    }
+                    std::cout << "Speech segment [" << segment.start << "s - " << segment.end << "s]: " << segment.text << std::endl;
+                }
+                finished.erase(finished.begin());
+                ++nextToReport;
+            }
+        };
+        
+        struct Speech {
+            size_t index;
+            float start;
+            float end;
+            std::vector<float> samples;
+        };
+        
+        size_t numWorkers = 0;
+        if (decode) {
+            numWorkers = settings.workers > 0 ? static_cast<size_t>(settings.workers) : std::max(1u, std::thread::hardware_concurrency());
+        }
+        BoundedQueue<Speech> queue(2 * numWorkers);
+        
+        // ASR consumers. Their calls overlap, so the stage's wall time runs from the first
+        // call's start to the last call's end.
+        std::mutex asrMutex;
+        double asrBusyMs = 0.0, asrCpuMs = 0.0;
+        std::chrono::steady_clock::time_point asrFirstStart, asrLastEnd;
+        int asrCalls = 0;
+        std::vector<std::thread> asrThreads;
+        for (size_t w = 0; w < numWorkers; ++w) {
+            asrThreads.emplace_back([&] {
+                Speech speech;
+                while (queue.Pop(speech)) {
+                    auto callStart = std::chrono::steady_clock::now();
+                    double cpuStart = ThreadCpuMs();
+                    std::string text = Decode(speech.samples.data(), static_cast<int32_t>(speech.samples.size()), settings, stats);
+                    {
+                        std::lock_guard<std::mutex> lock(asrMutex);
+                        asrFirstStart = asrCalls++ == 0 ? callStart : std::min(asrFirstStart, callStart);
+                        asrLastEnd = std::chrono::steady_clock::now();
+                        asrBusyMs += ElapsedMs(callStart);
+                        asrCpuMs += ThreadCpuMs() - cpuStart;
+                    }
+                    report(speech.index, SpeakerSegment{speech.start, speech.end, 1, text});
+                }
+            });
+        }
+        
+        // VAD producer
+        double vadWallMs = 0.0, vadCpuMs = 0.0;
+        size_t numDetected = 0;
+        RunVad(audio, kVadFeedSamples, false, [&](const SherpaOnnxSpeechSegment* segment) {
+            size_t index = numDetected++;
+            float start = segment->start / 16000.0f;
+            float stop = start + segment->n / 16000.0f;
+            if (index < journaled.size()) {
+                report(index, journaled[index]);
+                return;
+            }
+            if (!decode) {
+                report(index, SpeakerSegment{start, stop, 1, "[speech]"});
+                return;
+            }
+            queue.Push(Speech{index, start, stop, std::vector<float>(segment->samples, segment->samples + segment->n)});
+        }, vadWallMs, vadCpuMs);
+        
+        queue.Close();
+        for (auto& thread : asrThreads) {
+            thread.join();
+        }
+        if (journal) {
+            if (!journaled.empty()) {
+                std::cout << "Resumed " << std::min(journaled.size(), numDetected) << " of " << numDetected
+                          << " regions from the journal" << std::endl;
+            }
+            journal->Finish();
+        }
+        
+        auto end_time = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+        
+        std::cout << (decode ? "Transcription" : "Speech detection") << " completed in " << duration.count() << " ms" << std::endl;
+        if (decode) {
+            std::cout << std::fixed << std::setprecision(1) << "  VAD " << vadWallMs << " ms, ASR " << asrBusyMs << " ms over "
+                      << asrCalls << " call(s) on " << numWorkers << " worker(s)" << std::defaultfloat << std::setprecision(6) << std::endl;
+        }
+        
+        if (stats) {
+            stats->Record("vad", vadWallMs, vadCpuMs);
+            if (asrCalls > 0) {
+                stats->Record("asr", std::chrono::duration<double, std::milli>(asrLastEnd - asrFirstStart).count(), asrCpuMs);
+            }
+        }
+        
+        return true;
+    }
+    
+    // The recognizer and the diarization pipeline only hold read-only ONNX sessions, so
+    // several files may be transcribed concurrently from different threads.
+    //
+    // Long files are diarized in overlapping chunks so the pipeline's memory is bounded by the
+    // chunk length. Speakers are linked across chunks by embedding similarity, and each chunk's
+    // segments are transcribed (and reported) as soon as the chunk is diarized.
+    //
+    // With a journal, a resumed run replays the finished chunks without diarizing them again,
+    // restores the speaker linker as it was after them, and in the chunk that was interrupted
+    // only decodes the regions after the journaled ones.
+    //
+    // Returns false if the file could not be processed; segments then holds whatever was
+    // transcribed before the failure, which is not the whole file.
+    bool TranscribeWithDiarization(const std::string& wavFile, const DiarizationSettings& diarizationSettings,
+                                   const DecodeSettings& settings, std::vector<SpeakerSegment>& segments,
+                                   const SegmentCallback& onSegment = nullptr,
+                                   StageStats* stats = nullptr, SegmentJournal* journal = nullptr) {
+        if (!EnsureRecognizer() || !EnsureDiarization()) {
+            std::cerr << "Error: Transcription engine not initialized" << std::endl;
+            return false;
+        }
+        
+        if (!std::filesystem::exists(wavFile)) {
+            std::cerr << "Error: Audio file not found: " << wavFile << std::endl;
+            return false;
+        }
+        
+        std::cout << "Transcribing with speaker diarization: " << wavFile << std::endl;
+        
+        // Map the WAV file; each chunk is converted (and resampled) when it is diarized
+        WavReader wav;
+        {
+            StageTimer timer(stats, "wav_read");
+            if (!wav.Open(wavFile)) {
+                return false;
+            }
+        }
+        ResampledSource audio(wav, 16000);
+        PrintAudioInfo(wav, audio);
+        
+        if (stats) {
+            stats->SetAudioSeconds(audio.Seconds());
+        }
+        
+        auto start_time = std::chrono::high_resolution_clock::now();
+        
+        int64_t numSamples = audio.NumSamples();
+        int64_t chunkSamples = static_cast<int64_t>(diarizationSettings.chunkSeconds * audio.SampleRate());
+        int64_t overlapSamples = static_cast<int64_t>(diarizationSettings.chunkOverlapSeconds * audio.SampleRate());
+        bool chunked = chunkSamples > 0 && chunkSamples < numSamples && overlapSamples < chunkSamples / 2;
+        if (chunked && !EnsureEmbeddingExtractor()) {
+            std::cerr << "Warning: Diarizing the whole file at once, speakers cannot be linked across chunks" << std::endl;
+            chunked = false;
+        }
+        if (!chunked) {
+            chunkSamples = numSamples;
+            overlapSamples = 0;
+        }
+        
+        int64_t stepSamples = chunkSamples - overlapSamples;
+        int64_t numChunks = chunked ? (numSamples - overlapSamples + stepSamples - 1) / stepSamples : 1;
+        SpeakerLinker linker(diarizationSettings.linkThreshold);
+        std::vector<float> chunkBuffer;
+        bool ok = true;
+        auto addSegment = [&](const SpeakerSegment& segment) {
+            segments.push_back(segment);
+            if (onSegment) {
+                onSegment(segment);
+            }
+        };
+        
+        int64_t firstChunk = 0;
+        if (journal) {
+            journal->Start("diarize");
+            firstChunk = std::min(journal->ChunksDone(), numChunks);
+            for (int64_t chunk = 0; chunk < firstChunk; ++chunk) {
+                for (const auto& segment : journal->Regions(chunk)) {
+                    if (!segment.text.empty()) {
+                        addSegment(segment);
+                    }
+                }
+            }
+            if (firstChunk > 0) {
+                linker.Restore(journal->LinkerCentroids());
+                std::cout << "Resumed " << firstChunk << " of " << numChunks << " chunk(s) from the journal" << std::endl;
+            }
+        }
+        
+        for (int64_t chunk = firstChunk; chunk < numChunks; ++chunk) {
+            int64_t chunkStart = chunk * stepSamples;
+            int64_t chunkEnd = std::min(numSamples, chunkStart + chunkSamples);
+            
+            // Each chunk owns the middle of its overlaps with its neighbours
+            int64_t coreStart = chunk == 0 ? 0 : chunkStart + overlapSamples / 2;
+            int64_t coreEnd = chunk == numChunks - 1 ? numSamples : chunkEnd - overlapSamples / 2;
+            
+            if (chunked) {
+                std::cout << "Diarizing chunk " << (chunk + 1) << "/" << numChunks << " [" 
+                          << static_cast<float>(chunkStart) / audio.SampleRate() << "s - "
+                          << static_cast<float>(chunkEnd) / audio.SampleRate() << "s]" << std::endl;
+            }
+            
+            std::vector<SpeakerTurn> turns;
+            if (!DiarizeSpan(audio, chunkStart, chunkEnd, chunkBuffer, turns, stats)) {
+                ok = false;
+                break;
+            }
+            
+            if (chunked) {
+                // Map the chunk's local speaker labels onto speakers seen in earlier chunks
+                std::map<int, int> globalIds = linker.Link(SpeakerCentroids(audio, turns, stats));
+                for (auto& turn : turns) {
+                    if (!globalIds.count(turn.speaker)) {
+                        globalIds[turn.speaker] = linker.NewSpeaker();
+                    }
+                    turn.speaker = globalIds[turn.speaker];
+                }
+                turns = ClipTurns(turns, coreStart, coreEnd);
+            }
+            
+            TranscribeTurns(audio, turns, settings, addSegment, stats, journal, chunk);
+            if (journal) {
+                journal->AddChunk(chunk, linker.Centroids());
+            }
+        }
+        if (journal && ok && !journal->Complete()) {
+            journal->Finish();
+        }
+        
+        auto end_time = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+        
+        if (ok) {
+            std::cout << "Speaker diarization and transcription completed in " << duration.count() << " ms" << std::endl;
+        }
+        
+        return ok;
+    }
+    
+    // Speech regions [start, end) in 16 kHz samples, found by feeding the VAD feedSamples at a
+    // time (see RunVad for dropLastWindow). detectorMs receives the time spent in the detector.
+    bool DetectSpeech(const std::string& wavFile, int64_t feedSamples, bool dropLastWindow,
+                      std::vector<std::pair<int64_t, int64_t>>& regions, double& detectorMs) {
+        if (!EnsureVad()) {
+            std::cerr << "Error: Transcription engine not initialized" << std::endl;
+            return false;
+        }
+        
+        WavReader wav;
+        if (!wav.Open(wavFile)) {
+            return false;
+        }
+        ResampledSource audio(wav, 16000);
+        
+        std::lock_guard<std::mutex> vadLock(vadMutex);
+        double cpuMs = 0.0;
+        detectorMs = 0.0;
+        regions.clear();
+        RunVad(audio, feedSamples, dropLastWindow, [&](const SherpaOnnxSpeechSegment* segment) {
+            regions.emplace_back(segment->start, segment->start + segment->n);
+        }, detectorMs, cpuMs);
+        return true;
+    }
+    
+    bool IsInitialized() const {
+        return initialized;
+    }
+    
+    std::vector<std::string> ModelPaths() const {
+        return {modelPath, vadModelPath, segmentationModelPath, embeddingModelPath};
+    }
+    
+    const std::string& MainModelPath() const {
+        return modelPath;
+    }
+    
+    // First-pass model of --cascade; empty if none is configured
+    const std::string& FastModelPath() const {
+        return fastModelPath;
+    }
+};
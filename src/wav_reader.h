@@ -0,0 +1,421 @@
+#pragma once
+
+// Memory-mapped WAV reader and on-the-fly resampler. The file is mapped instead of read, so
+// opening a multi-GB recording is instant and only the spans that are actually requested
+// are paged in, converted to float and resampled to the rate the models expect.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <numeric>
+
+#include "mapped_file.h"
+
+// Mono float audio that can be read in arbitrary spans, e.g. a WAV file or a resampled view of one
+class AudioSource {
+public:
+    virtual ~AudioSource() {}
+    
+    virtual int SampleRate() const = 0;
+    virtual int64_t NumSamples() const = 0;
+    
+    // Writes samples [start, start + count) to out. The span must lie within the audio.
+    virtual void Read(int64_t start, int64_t count, float* out) const = 0;
+    
+    // Reads [start, end) into buffer, clamped to the audio, and returns the buffer's data.
+    // Callers keep the buffer around so repeated spans reuse its allocation.
+    const float* Span(int64_t start, int64_t end, std::vector<float>& buffer) const {
+        start = std::max<int64_t>(0, start);
+        end = std::min(end, NumSamples());
+        buffer.resize(static_cast<size_t>(std::max<int64_t>(0, end - start)));
+        if (!buffer.empty()) {
+            Read(start, end - start, buffer.data());
+        }
+        return buffer.data();
+    }
+    
+    double Seconds() const {
+        return SampleRate() > 0 ? static_cast<double>(NumSamples()) / SampleRate() : 0.0;
+    }
+};
+
+// Reads RIFF and RF64/BW64 WAV files with 16-, 24- or 32-bit integer or 32-bit float samples
+// (plain or WAVE_FORMAT_EXTENSIBLE) in any channel count. Channels are averaged to mono.
+class WavReader : public AudioSource {
+private:
+    enum class Encoding { Int16, Int24, Int32, Float32 };
+    
+    MappedFile file;
+    
+    const uint8_t* data = nullptr;
+    uint64_t dataBytes = 0;
+    int sampleRate = 0;
+    int channels = 0;
+    int bitsPerSample = 0;
+    int blockAlign = 0;
+    Encoding encoding = Encoding::Int16;
+    int64_t numFrames = 0;
+    
+    static uint16_t U16(const uint8_t* p) {
+        return static_cast<uint16_t>(p[0] | (p[1] << 8));
+    }
+    
+    static uint32_t U32(const uint8_t* p) {
+        return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+               (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+    
+    static uint64_t U64(const uint8_t* p) {
+        return static_cast<uint64_t>(U32(p)) | (static_cast<uint64_t>(U32(p + 4)) << 32);
+    }
+    
+    // Walks the chunk list for "fmt " and "data", skipping LIST, fact, bext and anything else
+    bool Parse(const std::string& path) {
+        const uint8_t* view = file.Data();
+        uint64_t fileBytes = file.Size();
+        if (fileBytes < 12 || std::memcmp(view + 8, "WAVE", 4) != 0) {
+            std::cerr << "Error: Not a WAV file: " << path << std::endl;
+            return false;
+        }
+        bool rf64 = std::memcmp(view, "RF64", 4) == 0 || std::memcmp(view, "BW64", 4) == 0;
+        if (!rf64 && std::memcmp(view, "RIFF", 4) != 0) {
+            std::cerr << "Error: Not a WAV file: " << path << std::endl;
+            return false;
+        }
+        
+        uint64_t rf64DataBytes = 0;
+        bool haveFormat = false;
+        uint16_t formatTag = 0;
+        uint64_t offset = 12;
+        while (offset + 8 <= fileBytes) {
+            const uint8_t* chunk = view + offset;
+            uint64_t chunkBytes = U32(chunk + 4);
+            uint64_t available = fileBytes - offset - 8;
+            
+            if (std::memcmp(chunk, "ds64", 4) == 0 && chunkBytes >= 16 && available >= 16) {
+                rf64DataBytes = U64(chunk + 16);
+            } else if (std::memcmp(chunk, "fmt ", 4) == 0 && chunkBytes >= 16 && available >= 16) {
+                formatTag = U16(chunk + 8);
+                channels = U16(chunk + 10);
+                sampleRate = static_cast<int>(U32(chunk + 12));
+                blockAlign = U16(chunk + 20);
+                bitsPerSample = U16(chunk + 22);
+                // WAVE_FORMAT_EXTENSIBLE keeps the real format in the first two bytes of the sub-format GUID
+                if (formatTag == 0xFFFE && chunkBytes >= 40 && available >= 40) {
+                    formatTag = U16(chunk + 32);
+                }
+                haveFormat = true;
+            } else if (std::memcmp(chunk, "data", 4) == 0) {
+                if (rf64 && chunkBytes == 0xFFFFFFFFu) {
+                    chunkBytes = rf64DataBytes;
+                }
+                // Recordings that were cut off (or are still being written) have a stale size
+                data = chunk + 8;
+                dataBytes = std::min(chunkBytes, available);
+                break;
+            }
+            
+            // Chunks are padded to an even size
+            offset += 8 + chunkBytes + (chunkBytes & 1);
+        }
+        
+        if (!haveFormat || data == nullptr) {
+            std::cerr << "Error: WAV file has no " << (haveFormat ? "data" : "fmt") << " chunk: " << path << std::endl;
+            return false;
+        }
+        
+        if (formatTag == 1 && bitsPerSample == 16) {
+            encoding = Encoding::Int16;
+        } else if (formatTag == 1 && bitsPerSample == 24) {
+            encoding = Encoding::Int24;
+        } else if (formatTag == 1 && bitsPerSample == 32) {
+            encoding = Encoding::Int32;
+        } else if (formatTag == 3 && bitsPerSample == 32) {
+            encoding = Encoding::Float32;
+        } else {
+            std::cerr << "Error: Unsupported WAV encoding (format " << formatTag << ", " << bitsPerSample
+                      << " bits): " << path << std::endl;
+            return false;
+        }
+        
+        if (channels <= 0 || sampleRate <= 0 || blockAlign < channels * (bitsPerSample / 8)) {
+            std::cerr << "Error: Invalid WAV format header: " << path << std::endl;
+            return false;
+        }
+        
+        numFrames = static_cast<int64_t>(dataBytes / blockAlign);
+        return true;
+    }
+    
+    void Close() {
+        file.Close();
+        data = nullptr;
+        dataBytes = 0;
+        numFrames = 0;
+    }
+    
+    template <typename Convert>
+    void Downmix(const uint8_t* frame, int64_t count, float* out, int bytesPerSample, Convert convert) const {
+        if (channels == 1) {
+            for (int64_t i = 0; i < count; ++i, frame += blockAlign) {
+                out[i] = convert(frame);
+            }
+            return;
+        }
+        float scale = 1.0f / channels;
+        for (int64_t i = 0; i < count; ++i, frame += blockAlign) {
+            float sum = 0.0f;
+            for (int c = 0; c < channels; ++c) {
+                sum += convert(frame + c * bytesPerSample);
+            }
+            out[i] = sum * scale;
+        }
+    }
+    
+public:
+    WavReader() {}
+    
+    WavReader(const WavReader&) = delete;
+    WavReader& operator=(const WavReader&) = delete;
+    
+    ~WavReader() {
+        Close();
+    }
+    
+    // Maps and parses the file; prints the reason and returns false if it cannot be read
+    bool Open(const std::string& path) {
+        Close();
+        if (!file.Open(path)) {
+            std::cerr << "Error: Failed to read WAV file: " << path << std::endl;
+            Close();
+            return false;
+        }
+        if (!Parse(path)) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+    
+    int SampleRate() const override {
+        return sampleRate;
+    }
+    
+    int64_t NumSamples() const override {
+        return numFrames;
+    }
+    
+    int Channels() const {
+        return channels;
+    }
+    
+    int BitsPerSample() const {
+        return bitsPerSample;
+    }
+    
+    bool IsFloat() const {
+        return encoding == Encoding::Float32;
+    }
+    
+    // The raw sample bytes, e.g. for hashing the audio without converting it
+    const uint8_t* Data() const {
+        return data;
+    }
+    
+    uint64_t DataBytes() const {
+        return static_cast<uint64_t>(numFrames) * blockAlign;
+    }
+    
+    void Read(int64_t start, int64_t count, float* out) const override {
+        const uint8_t* frame = data + static_cast<uint64_t>(start) * blockAlign;
+        switch (encoding) {
+            case Encoding::Int16:
+                Downmix(frame, count, out, 2, [](const uint8_t* p) {
+                    return static_cast<int16_t>(U16(p)) * (1.0f / 32768.0f);
+                });
+                break;
+            case Encoding::Int24:
+                Downmix(frame, count, out, 3, [](const uint8_t* p) {
+                    int32_t value = static_cast<int32_t>(static_cast<uint32_t>(p[0]) << 8 | static_cast<uint32_t>(p[1]) << 16 |
+                                                         static_cast<uint32_t>(p[2]) << 24) >> 8;
+                    return value * (1.0f / 8388608.0f);
+                });
+                break;
+            case Encoding::Int32:
+                Downmix(frame, count, out, 4, [](const uint8_t* p) {
+                    return static_cast<float>(static_cast<int32_t>(U32(p)) * (1.0 / 2147483648.0));
+                });
+                break;
+            case Encoding::Float32:
+                Downmix(frame, count, out, 4, [](const uint8_t* p) {
+                    float value;
+                    std::memcpy(&value, p, sizeof(value));
+                    return value;
+                });
+                break;
+        }
+    }
+};
+
+// Whether a WAV file has been completely written: its RIFF (or RF64 ds64) size is set and
+// the file is at least that long. Writers put the final size into the header either up
+// front (the recorder) or when they finish (streaming writers leave 0 or 0xFFFFFFFF), so
+// a file that is still growing never passes.
+inline bool IsWavFinalized(const std::string& path) {
+    std::error_code ec;
+    uint64_t fileBytes = std::filesystem::file_size(path, ec);
+    std::ifstream file(path, std::ios::binary);
+    uint8_t header[36] = {};
+    if (ec || !file.read(reinterpret_cast<char*>(header), 12) || std::memcmp(header + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+    
+    uint64_t riffBytes = 0;
+    if (std::memcmp(header, "RIFF", 4) == 0) {
+        riffBytes = header[4] | (header[5] << 8) | (header[6] << 16) | (static_cast<uint32_t>(header[7]) << 24);
+        if (riffBytes == 0xFFFFFFFFu) {
+            return false;
+        }
+    } else if (std::memcmp(header, "RF64", 4) == 0 || std::memcmp(header, "BW64", 4) == 0) {
+        // The 64-bit sizes live in the ds64 chunk that has to follow the header
+        if (!file.read(reinterpret_cast<char*>(header + 12), 24) || std::memcmp(header + 12, "ds64", 4) != 0) {
+            return false;
+        }
+        for (int i = 7; i >= 0; --i) {
+            riffBytes = (riffBytes << 8) | header[20 + i];
+        }
+    } else {
+        return false;
+    }
+    return riffBytes > 4 && riffBytes + 8 <= fileBytes;
+}
+
+// Resamples another source to a target rate as spans are read, without an intermediate file.
+// Every output sample is computed from its own position with a windowed-sinc polyphase
+// filter, so spans can be read in any order, and from several threads, and still join
+// seamlessly. Equal rates pass straight through and integer decimation (48 or 32 kHz to
+// 16 kHz) uses a single filter phase.
+class ResampledSource : public AudioSource {
+private:
+    const AudioSource& source;
+    int targetRate;
+    int64_t up = 1;      // The ratio targetRate / source rate, reduced
+    int64_t down = 1;
+    int halfTaps = 0;    // Filter half-length, in input samples
+    std::vector<float> filters;  // One row of 2 * halfTaps coefficients per phase
+    
+    void DesignFilters() {
+        const double kPi = 3.14159265358979323846;
+        const double kZeroCrossings = 12.0;
+        const double kPassband = 0.9;  // Fraction of the lower Nyquist frequency that is kept
+        
+        // Cutoff in cycles per input sample; below the output's Nyquist frequency when decimating
+        double cutoff = 0.5 * kPassband * std::min(1.0, static_cast<double>(up) / down);
+        halfTaps = static_cast<int>(std::ceil(kZeroCrossings / (2.0 * cutoff)));
+        int taps = 2 * halfTaps;
+        
+        filters.assign(static_cast<size_t>(up * taps), 0.0f);
+        std::vector<double> values(taps);
+        for (int64_t phase = 0; phase < up; ++phase) {
+            float* row = &filters[static_cast<size_t>(phase * taps)];
+            double sum = 0.0;
+            for (int k = 0; k < taps; ++k) {
+                // Distance of tap k from the output sample, in input samples
+                double distance = (k - halfTaps + 1) - static_cast<double>(phase) / up;
+                double x = 2.0 * cutoff * distance;
+                double sinc = std::abs(x) < 1e-9 ? 1.0 : std::sin(kPi * x) / (kPi * x);
+                double window = 0.42 + 0.5 * std::cos(kPi * distance / halfTaps) + 0.08 * std::cos(2.0 * kPi * distance / halfTaps);
+                values[k] = sinc * window;
+                sum += values[k];
+            }
+            // Unity gain at DC for every phase
+            for (int k = 0; k < taps; ++k) {
+                row[k] = static_cast<float>(values[k] / sum);
+            }
+        }
+    }
+    
+    static float Dot(const float* a, const float* b, int n) {
+        float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+        int k = 0;
+        for (; k + 4 <= n; k += 4) {
+            s0 += a[k] * b[k];
+            s1 += a[k + 1] * b[k + 1];
+            s2 += a[k + 2] * b[k + 2];
+            s3 += a[k + 3] * b[k + 3];
+        }
+        for (; k < n; ++k) {
+            s0 += a[k] * b[k];
+        }
+        return (s0 + s1) + (s2 + s3);
+    }
+    
+    // Resamples outputs [start, start + count) through input, a scratch buffer
+    void ReadBlock(int64_t start, int64_t count, float* out, std::vector<float>& input) const {
+        // Input span covering every tap of the block, zero-padded past either end of the source
+        int64_t first = start * down / up - halfTaps + 1;
+        int64_t last = (start + count - 1) * down / up + halfTaps;
+        input.assign(static_cast<size_t>(last - first + 1), 0.0f);
+        int64_t from = std::max<int64_t>(first, 0);
+        int64_t to = std::min(last + 1, source.NumSamples());
+        if (to > from) {
+            source.Read(from, to - from, input.data() + (from - first));
+        }
+        
+        int taps = 2 * halfTaps;
+        if (up == 1) {
+            for (int64_t i = 0; i < count; ++i) {
+                out[i] = Dot(filters.data(), input.data() + i * down, taps);
+            }
+            return;
+        }
+        for (int64_t i = 0; i < count; ++i) {
+            int64_t position = (start + i) * down;
+            int64_t phase = position % up;
+            int64_t offset = position / up - halfTaps + 1 - first;
+            out[i] = Dot(&filters[static_cast<size_t>(phase * taps)], input.data() + offset, taps);
+        }
+    }
+    
+public:
+    ResampledSource(const AudioSource& source, int targetRate) : source(source), targetRate(targetRate) {
+        if (source.SampleRate() > 0 && source.SampleRate() != targetRate) {
+            int64_t divisor = std::gcd<int64_t>(targetRate, source.SampleRate());
+            up = targetRate / divisor;
+            down = source.SampleRate() / divisor;
+            DesignFilters();
+        }
+    }
+    
+    bool IsResampling() const {
+        return up != down;
+    }
+    
+    int SampleRate() const override {
+        return IsResampling() ? targetRate : source.SampleRate();
+    }
+    
+    int64_t NumSamples() const override {
+        return source.NumSamples() * up / down;
+    }
+    
+    void Read(int64_t start, int64_t count, float* out) const override {
+        if (!IsResampling()) {
+            source.Read(start, count, out);
+            return;
+        }
+        
+        // Work in blocks so the scratch input stays small however long the span is
+        const int64_t kBlockSamples = 16384;
+        thread_local std::vector<float> input;
+        for (int64_t done = 0; done < count; done += kBlockSamples) {
+            ReadBlock(start + done, std::min(kBlockSamples, count - done), out + done, input);
+        }
+    }
+};